@@ -1,45 +1,441 @@
 #include <cute.h>
+#include <cute/cute_aseprite.h>
 #include <dcimgui.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <inttypes.h>
 
 #ifndef __EMSCRIPTEN__
 #include <nfd.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#include <share.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#endif
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 #endif
 
 #define MAX_NUM_VERTICES 128
-#define MAX_HISTORY_ENTRIES 128
+#define HISTORY_CHUNK_SIZE 16
 #define VERT_SIZE 8.f
+#define MAX_LOD_LEVELS 16
+#define LOD_PIXEL_ERROR 0.5f
+#define JOURNAL_MAGIC "CSJ2"
+#define JOURNAL_FLUSH_INTERVAL 1.f
+#define JOURNAL_RETRY_INTERVAL 5.f
+#define JOURNAL_MAX_SLOTS 8
+#define FIT_ALPHA_THRESHOLD 128
+#define SPRITE_CACHE_BUDGET ((size_t)256 * 1024 * 1024)
+#define SPRITE_PREFETCH_RADIUS 2
+#define WATCH_DEBOUNCE 0.25f
+#define WATCH_POLL_INTERVAL 0.5f
+#define HASH_SEED 14695981039346656037ull
+#define INPUT_RECORDING_MAGIC "CSI1"
+#define PLAYGROUND_MAX_BODIES 20000
+#define PLAYGROUND_MAX_TASKS 64
+#define PLAYGROUND_MAX_GRID 256
+#define PLAYGROUND_GRAVITY 500.f
+#define IMPORT_TOLERANCE 0.25f
+#define IMPORT_MAX_DEPTH 64
+#define IMPORT_MAX_SUBDIVISIONS 16
+#define IMPORT_MAX_ARC_SEGMENTS 1024
+#define IMPORT_MAX_OPEN_ALL 32
+#define XML_MAX_ATTRS 32
 
 typedef struct {
 	CF_V2 verts[MAX_NUM_VERTICES];
 	int num_vertices;
 } shape_t;
 
+// Immutable once created, shared between history nodes
 typedef struct {
-	shape_t shape;
+	int ref_count;
+	int num_vertices;
+	CF_V2 verts[];
+} vertex_chunk_t;
+
+typedef struct shape_node_s shape_node_t;
+
+struct shape_node_s {
+	shape_node_t* parent;
+	shape_node_t* first_child;
+	shape_node_t* next_sibling;
+	shape_node_t* redo_child;  // Where redo goes from here
 	uint64_t version;
-} shape_history_entry_t;
+	int num_vertices;
+	dyna vertex_chunk_t** chunks;
+};
 
 typedef struct {
-	shape_history_entry_t entries[MAX_HISTORY_ENTRIES];
-	int current_index;
+	shape_t working;  // Editable copy of the current node
+	shape_node_t* root;
+	shape_node_t* current;
 	uint64_t current_version;
+	uint64_t generation;  // Bumped when reset, versions start over
+	int num_nodes;
+	int num_chunks;
+	size_t chunk_bytes;
 } shape_history_t;
 
+typedef enum {
+	INPUT_KEY_CTRL,
+	INPUT_KEY_SHIFT,
+	INPUT_KEY_N,
+	INPUT_KEY_O,
+	INPUT_KEY_S,
+	INPUT_KEY_W,
+	INPUT_KEY_PAGE_UP,
+	INPUT_KEY_PAGE_DOWN,
+	INPUT_KEY_COUNT,
+} input_key_t;
+
+typedef enum {
+	NAV_NONE,
+	NAV_BACK,
+	NAV_FORWARD
+} nav_t;
+
+enum {
+	INPUT_CAPTURE_MOUSE = 1 << 0,
+	INPUT_CAPTURE_KEYBOARD = 1 << 1,
+};
+
+// Everything the main loop reads from the user in one frame. Recordings
+// are a sequence of these, so only fixed size fields.
+typedef struct {
+	float mouse_x;
+	float mouse_y;
+	float wheel;
+	int32_t width;
+	int32_t height;
+	uint32_t buttons_down;  // Bit per CF_MouseButton
+	uint32_t buttons_pressed;
+	uint32_t keys_down;  // Bit per input_key_t
+	uint32_t keys_pressed;
+	uint32_t nav;
+	uint32_t ui_capture;
+} input_frame_t;
+
+#ifndef __EMSCRIPTEN__
+
+typedef struct {
+	FILE* file;
+} input_recorder_t;
+
+typedef struct {
+	input_frame_t* frames;
+	int num_frames;
+	int next_frame;
+	dyna double* frame_times;  // In milliseconds
+} input_replay_t;
+
+#endif
+
 typedef struct {
 	CF_V2* point;
 	float scale;
 	CF_MouseButton button;
+	const input_frame_t* input;
 } mouse_drag_info_t;
 
+typedef struct {
+	CF_Aabb view;
+	dyna CF_V2* positions;
+	dyna int* indices;
+} handle_batch_t;
+
+typedef struct {
+	bool valid;
+	dyna CF_V2* verts;
+} polyline_lod_level_t;
+
+typedef struct {
+	uint64_t doc_id;
+	uint64_t generation;
+	uint64_t version;
+	polyline_lod_level_t levels[MAX_LOD_LEVELS];
+	dyna int* stack;
+	dyna bool* keep;
+} polyline_lod_t;
+
+typedef struct {
+	int start;
+	int end;
+	bool false_positive;
+} fit_span_t;
+
+typedef struct {
+	int true_positive;
+	int false_positive;
+	int false_negative;
+	dyna fit_span_t* spans;
+} fit_row_t;
+
+// Compares the shape against the sprite's alpha, one bit per pixel
+typedef struct {
+	int width;
+	int height;
+	int words_per_row;
+	uint64_t* mask;
+	uint64_t* coverage;
+	fit_row_t* rows;
+
+	// What coverage was last rasterized from
+	bool valid;
+	dyna CF_V2* verts;
+	dyna float* crossings;
+
+	int64_t true_positive;
+	int64_t false_positive;
+	int64_t false_negative;
+} fit_metrics_t;
+
+typedef enum {
+	PLAYGROUND_CIRCLES,
+	PLAYGROUND_BOXES,
+} playground_body_kind_t;
+
+typedef struct {
+	CF_V2 pos;
+	CF_V2 vel;
+} playground_body_t;
+
+// Uniform grid stored as one flat item list per cell, cell i owns
+// items[offsets[i]] to items[offsets[i + 1]]
+typedef struct {
+	dyna int* offsets;
+	dyna int* items;
+} playground_grid_t;
+
+typedef struct playground_s playground_t;
+
+typedef struct {
+	playground_t* playground;
+	int first_body;
+	int num_bodies;
+	CF_Rnd rnd;
+	uint64_t shape_ticks;
+	uint64_t body_ticks;
+	int shape_tests;
+	int shape_contacts;
+	int body_tests;
+} playground_task_t;
+
+struct playground_s {
+	int kind;
+	int num_bodies;
+	float body_size;  // Radius of circles, half extent of boxes
+	bool collide_bodies;
+	bool running;
+	bool draw_bodies;
+
+	dyna playground_body_t* bodies;
+	dyna playground_body_t* next_bodies;
+
+	// The shape being tested, edges are rebinned when it changes
+	const shape_t* shape;
+	uint64_t shape_version;
+	float grid_body_size;
+	dyna CF_Capsule* edges;
+	CF_Aabb bounds;
+	float cell_size;
+	int grid_width;
+	int grid_height;
+	playground_grid_t edge_grid;
+	playground_grid_t body_grid;
+
+#ifndef __EMSCRIPTEN__
+	CF_Threadpool* pool;  // Shared with the sprite cache, not owned
+#endif
+	playground_task_t tasks[PLAYGROUND_MAX_TASKS];
+	int num_tasks;
+
+	// Smoothed over frames
+	double step_ms;
+	double shape_tests_per_second;
+	double ns_per_shape_test;
+	double ns_per_contact;
+	double ns_per_body_test;
+	double us_per_vertex;
+	int shape_contacts;
+	int body_tests;
+};
+
+typedef struct {
+	char* path;
+	CF_Sprite sprite;
+	uint64_t* mask;  // Alpha mask for fit metrics, may be NULL
+	int width;
+	int height;
+	int num_frames;
+	size_t size;
+	uint64_t id;  // Changes whenever the sprite is reloaded
+	uint64_t reload_serial;
+	int ref_count;
+	uint64_t last_used;
+} sprite_cache_entry_t;
+
+typedef struct sprite_prefetch_s sprite_prefetch_t;
+
+typedef struct {
+	dyna sprite_cache_entry_t** entries;
+	size_t total_size;
+	uint64_t clock;
+#ifndef __EMSCRIPTEN__
+	CF_Threadpool* pool;
+	CF_Mutex lock;
+	dyna sprite_prefetch_t** prefetched;  // Guarded by lock
+	dyna char** in_flight;
+#endif
+} sprite_cache_t;
+
 typedef struct {
 	char* filename;
+	char* name;  // Shown instead of the file name while there is none
+#ifdef __EMSCRIPTEN__
+	int save_handle;  // File the browser last saved this to, 0 asks for one
+#endif
 
 	uint64_t saved_version;
+	uint64_t disk_hash;  // Of the content last read or written
 } document_t;
 
+typedef struct {
+	uint64_t id;  // Never reused, unlike the address
+	document_t doc;
+	shape_history_t* history;
+	sprite_cache_entry_t* sprite_entry;  // NULL for the demo sprite
+	uint64_t sprite_id;
+	CF_Sprite sprite;
+	char* animation;  // Kept so a reloaded sprite resumes it
+	CF_V2 draw_offset;
+	float draw_scale;
+} workspace_doc_t;
+
+typedef struct {
+	dyna workspace_doc_t** docs;
+	int active;
+	bool select_active;  // Make the tab bar follow active on the next frame
+	CF_Sprite demo_sprite;
+	sprite_cache_t* sprite_cache;
+	uint64_t next_doc_id;
+	bool journal_dirty;  // Some document changed outside of the journal
+} workspace_t;
+
+typedef struct {
+	int name;  // Offset into import_t.names
+	int first_vertex;
+	int num_vertices;
+} import_object_t;
+
+// All objects of an imported file share one vertex and one name array, so
+// a map with tens of thousands of objects costs a handful of allocations
+typedef struct {
+	char* source;
+	double seconds;
+	dyna CF_V2* verts;
+	dyna char* names;
+	dyna import_object_t* objects;
+	int num_batch_opened;  // Objects opened through "Open next" so far
+
+	// Scratch
+	dyna CF_V2* points;  // Outline being built
+	dyna CF_V2* raw;  // Points read before their transform is known
+	dyna CF_V2* simplified;
+	polyline_lod_t simplify;
+} import_t;
+
+// SVG style affine transform: x' = a x + c y + e, y' = b x + d y + f
+typedef struct {
+	float a, b, c, d, e, f;
+} affine_t;
+
+typedef struct {
+	CF_V2 p[4];
+	int depth;
+} bezier_t;
+
+typedef struct {
+	const char* name;
+	int name_len;
+	const char* value;
+	int value_len;
+} xml_attr_t;
+
+// Pulls one tag at a time out of a buffer, attributes point into it
+typedef struct {
+	const char* cursor;
+	const char* end;
+	const char* name;
+	int name_len;
+	bool closing;
+	bool self_closing;
+	xml_attr_t attrs[XML_MAX_ATTRS];
+	int num_attrs;
+} xml_reader_t;
+
+typedef struct {
+	const char* cursor;
+	const char* end;
+	int depth;
+	bool failed;
+} json_reader_t;
+
+#ifndef __EMSCRIPTEN__
+
+typedef struct {
+	char* path;
+	int wd;  // inotify watch on the parent folder, -1 when polled
+	int64_t mtime;
+	int64_t size;
+	float debounce;  // Time left until the change is reported
+	bool pending;
+	bool wanted;
+} watched_file_t;
+
+typedef struct {
+	dyna watched_file_t* files;
+	int inotify_fd;  // -1 when everything is polled
+	float time_since_poll;
+	dyna const char** changed;  // Files whose writes settled this frame
+} file_watcher_t;
+
+#endif
+
+typedef enum {
+	JOURNAL_OP_BEGIN,
+	JOURNAL_OP_COMMIT,
+	JOURNAL_OP_INSERT,
+	JOURNAL_OP_REMOVE,
+	JOURNAL_OP_SET,
+	JOURNAL_OP_UNDO,
+	JOURNAL_OP_REDO,
+	JOURNAL_OP_BACKGROUND,  // Unsaved document in another tab, same layout as BEGIN
+} journal_op_t;
+
+typedef struct {
+	bool open;
+	dyna uint8_t* pending;  // Encoded records waiting for the next flush
+	int last_record;  // Offset of the last pending record, for coalescing
+	int num_undoable;
+	int num_redoable;
+	float time_since_flush;
+#ifndef __EMSCRIPTEN__
+	char* path;
+	FILE* file;
+	int lock_fd;  // Held for as long as we own the journal at path
+	bool failed;  // Nothing is being recorded until the next journal_begin
+	float time_since_failure;
+#endif
+} journal_t;
+
 typedef struct {
 	const char* message;
 	ImGuiID id;
@@ -51,6 +447,11 @@ typedef enum {
 	COMMAND_OPEN,
 	COMMAND_SAVE,
 	COMMAND_SAVE_AS,
+	COMMAND_CLOSE,
+	COMMAND_RECOVER,
+	COMMAND_LOAD_SPRITE,
+	COMMAND_NEXT_SPRITE,
+	COMMAND_PREV_SPRITE,
 } command_t;
 
 typedef enum {
@@ -111,6 +512,44 @@ save_into_file(const char* path, const void* data, size_t size) {
 	return written == size;
 }
 
+static bool
+sync_file(FILE* f) {
+	if (fflush(f) != 0) { return false; }
+#ifdef _WIN32
+	return _commit(_fileno(f)) == 0;
+#else
+	return fsync(fileno(f)) == 0;
+#endif
+}
+
+// Returns a descriptor holding an exclusive lock on path, -1 when another
+// process already holds it
+static int
+lock_file(const char* path) {
+#ifdef _WIN32
+	int fd = -1;
+	if (_sopen_s(&fd, path, _O_RDWR | _O_CREAT, _SH_DENYRW, _S_IREAD | _S_IWRITE) != 0) { return -1; }
+	return fd;
+#else
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd < 0) { return -1; }
+	if (lockf(fd, F_TLOCK, 0) != 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+#endif
+}
+
+static void
+unlock_file(int fd) {
+#ifdef _WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
 static char*
 strprintf(const char* fmt, ...) {
 	va_list args, args_copy;
@@ -128,22 +567,50 @@ strprintf(const char* fmt, ...) {
 
 #else
 
-extern bool
-web_open_file(
-	const char* filter,
-	char** name,
-	void** content,
-	size_t* size
-);
-
-extern enum {
-	NAV_NONE,
-	NAV_BACK,
-	NAV_FORWARD
-} web_nav(void);
+typedef enum {
+	WEB_FILE_PENDING,
+	WEB_FILE_READY,
+	WEB_FILE_CANCELLED,
+} web_file_status_t;
+
+typedef struct {
+	char* name;
+	void* content;
+	size_t size;
+	// Non-zero when the browser already decoded an image into RGBA pixels
+	int width;
+	int height;
+} web_file_t;
+
+extern void
+web_request_file(const char* filter, bool decode_images);
+
+extern web_file_status_t
+web_poll_file(web_file_t* file);
+
+extern nav_t
+web_nav(void);
+
+typedef enum {
+	WEB_SAVE_PENDING,
+	WEB_SAVE_DONE,
+	WEB_SAVE_CANCELLED,
+	WEB_SAVE_ERROR,
+} web_save_status_t;
+
+// Asks for a file when handle is 0. Data is copied before this returns.
+extern void
+web_request_save(int handle, const char* name, const void* data, size_t size);
+
+// The name is allocated with malloc, or NULL when the file was downloaded
+extern web_save_status_t
+web_poll_save(int* handle, char** name);
 
 extern bool
-save_into_file(const char* path, const void* data, size_t size);
+web_journal_load(void** content, size_t* size);
+
+extern void
+web_journal_append(const void* data, size_t size, bool truncate);
 
 #endif
 
@@ -155,6 +622,25 @@ strclone(const char* str) {
 	return cpy;
 }
 
+static const char*
+path_basename(const char* path) {
+	const char* slash = strrchr(path, '/');
+	const char* backslash = strrchr(path, '\\');
+	if (backslash > slash) { slash = backslash; }
+	return slash != NULL ? slash + 1 : path;
+}
+
+// FNV-1a
+static uint64_t
+hash_bytes(uint64_t hash, const void* data, size_t size) {
+	const uint8_t* bytes = data;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
 static bool
 str_ends_with(const char *str, const char *suffix) {
 	if (!str || !suffix) { return false; }
@@ -183,6 +669,29 @@ point_to_segment_distance_squared(CF_V2 p, CF_V2 a, CF_V2 b) {
     return cf_dot(d, d);
 }
 
+static int
+popcount64(uint64_t x) {
+	// The builtin turns into a library call on targets without the instruction
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__POPCNT__) || defined(__aarch64__))
+	return __builtin_popcountll(x);
+#else
+	x = x - ((x >> 1) & 0x5555555555555555ull);
+	x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+	return (int)((x * 0x0101010101010101ull) >> 56);
+#endif
+}
+
+// x must not be zero
+static int
+count_trailing_zeros64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctzll(x);
+#else
+	return popcount64((x & (~x + 1)) - 1);
+#endif
+}
+
 static void
 start_modal(CF_Coroutine* modal_coro, CF_CoroutineFn fn, void* context) {
 	if (modal_coro->id != 0) { return; }
@@ -190,14 +699,241 @@ start_modal(CF_Coroutine* modal_coro, CF_CoroutineFn fn, void* context) {
 	cf_coroutine_resume(*modal_coro);  // Let it copy the userdata before it goes out of scope
 }
 
+#ifdef __EMSCRIPTEN__
+
+// The browser picker is asynchronous so wait for it one frame at a time.
+// File content is streamed straight into a single heap allocation.
+static bool
+web_open_file(CF_Coroutine coro, const char* filter, bool decode_images, web_file_t* file) {
+	web_request_file(filter, decode_images);
+
+	web_file_status_t status;
+	while ((status = web_poll_file(file)) == WEB_FILE_PENDING) {
+		cf_coroutine_yield(coro);
+	}
+
+	return status == WEB_FILE_READY;
+}
+
+// Only returns SAVE_OK once the browser has written the file
+static save_result_t
+web_save_file(CF_Coroutine coro, document_t* doc, const void* data, size_t size) {
+	web_request_save(doc->save_handle, doc->filename, data, size);
+
+	web_save_status_t status;
+	int handle = 0;
+	char* name = NULL;
+	while ((status = web_poll_save(&handle, &name)) == WEB_SAVE_PENDING) {
+		cf_coroutine_yield(coro);
+	}
+
+	doc->save_handle = handle;
+	if (name != NULL) {
+		cf_free(doc->filename);
+		doc->filename = strclone(name);
+		free(name);
+	}
+
+	switch (status) {
+		case WEB_SAVE_DONE: return SAVE_OK;
+		case WEB_SAVE_CANCELLED: return SAVE_CANCELLED;
+		default: return SAVE_ERROR;
+	}
+}
+
+#endif
+
+// Input
+//
+// The main loop reads input through an input_frame_t instead of asking CF
+// directly, so a recorded session can be fed back in place of the user.
+
+static const CF_KeyButton input_keys[INPUT_KEY_COUNT][2] = {
+	[INPUT_KEY_CTRL] = { CF_KEY_LCTRL, CF_KEY_RCTRL },
+	[INPUT_KEY_SHIFT] = { CF_KEY_LSHIFT, CF_KEY_RSHIFT },
+	[INPUT_KEY_N] = { CF_KEY_N, CF_KEY_N },
+	[INPUT_KEY_O] = { CF_KEY_O, CF_KEY_O },
+	[INPUT_KEY_S] = { CF_KEY_S, CF_KEY_S },
+	[INPUT_KEY_W] = { CF_KEY_W, CF_KEY_W },
+	[INPUT_KEY_PAGE_UP] = { CF_KEY_PAGEUP, CF_KEY_PAGEUP },
+	[INPUT_KEY_PAGE_DOWN] = { CF_KEY_PAGEDOWN, CF_KEY_PAGEDOWN },
+};
+
+static const CF_MouseButton input_buttons[] = {
+	CF_MOUSE_BUTTON_LEFT,
+	CF_MOUSE_BUTTON_RIGHT,
+	CF_MOUSE_BUTTON_MIDDLE,
+	CF_MOUSE_BUTTON_X1,
+	CF_MOUSE_BUTTON_X2,
+};
+
+static void
+input_capture(input_frame_t* input) {
+	*input = (input_frame_t){
+		.mouse_x = cf_mouse_x(),
+		.mouse_y = cf_mouse_y(),
+		.wheel = cf_mouse_wheel_motion(),
+		.width = cf_app_get_width(),
+		.height = cf_app_get_height(),
+	};
+
+	for (size_t i = 0; i < sizeof(input_buttons) / sizeof(input_buttons[0]); ++i) {
+		CF_MouseButton button = input_buttons[i];
+		if (cf_mouse_down(button)) { input->buttons_down |= 1u << button; }
+		if (cf_mouse_just_pressed(button)) { input->buttons_pressed |= 1u << button; }
+	}
+
+	for (int key = 0; key < INPUT_KEY_COUNT; ++key) {
+		if (cf_key_down(input_keys[key][0]) || cf_key_down(input_keys[key][1])) {
+			input->keys_down |= 1u << key;
+		}
+		if (cf_key_just_pressed(input_keys[key][0]) || cf_key_just_pressed(input_keys[key][1])) {
+			input->keys_pressed |= 1u << key;
+		}
+	}
+
+	ImGuiIO* io = ImGui_GetIO();
+	if (io->WantCaptureMouse) { input->ui_capture |= INPUT_CAPTURE_MOUSE; }
+	if (io->WantCaptureKeyboard) { input->ui_capture |= INPUT_CAPTURE_KEYBOARD; }
+}
+
+static bool
+input_button_down(const input_frame_t* input, CF_MouseButton button) {
+	return (input->buttons_down & (1u << button)) != 0;
+}
+
+static bool
+input_button_pressed(const input_frame_t* input, CF_MouseButton button) {
+	return (input->buttons_pressed & (1u << button)) != 0;
+}
+
+static bool
+input_key_down(const input_frame_t* input, input_key_t key) {
+	return (input->keys_down & (1u << key)) != 0;
+}
+
+static bool
+input_key_pressed(const input_frame_t* input, input_key_t key) {
+	return (input->keys_pressed & (1u << key)) != 0;
+}
+
+#ifndef __EMSCRIPTEN__
+
+static bool
+input_recorder_open(input_recorder_t* recorder, const char* path) {
+	recorder->file = fopen(path, "wb");
+	if (recorder->file == NULL) { return false; }
+
+	size_t magic_size = sizeof(INPUT_RECORDING_MAGIC) - 1;
+	if (fwrite(INPUT_RECORDING_MAGIC, 1, magic_size, recorder->file) != magic_size) {
+		fclose(recorder->file);
+		recorder->file = NULL;
+		return false;
+	}
+	return true;
+}
+
+// Returns false once the recording had to stop, a truncated recording
+// would replay into a different session
+static bool
+input_recorder_write(input_recorder_t* recorder, const input_frame_t* input) {
+	if (recorder->file == NULL) { return true; }
+
+	if (fwrite(input, sizeof(*input), 1, recorder->file) != 1) {
+		fclose(recorder->file);
+		recorder->file = NULL;
+		return false;
+	}
+	return true;
+}
+
+static bool
+input_recorder_close(input_recorder_t* recorder) {
+	if (recorder->file == NULL) { return true; }
+
+	bool flushed = fclose(recorder->file) == 0;
+	recorder->file = NULL;
+	return flushed;
+}
+
+// Recordings are raw frames in native byte order
+static bool
+input_replay_open(input_replay_t* replay, const char* path) {
+	*replay = (input_replay_t){ 0 };
+
+	size_t size = 0;
+	uint8_t* content = load_file_into_memory(path, &size);
+	if (content == NULL) { return false; }
+
+	size_t magic_size = sizeof(INPUT_RECORDING_MAGIC) - 1;
+	bool valid = size >= magic_size
+		&& memcmp(content, INPUT_RECORDING_MAGIC, magic_size) == 0
+		&& (size - magic_size) % sizeof(input_frame_t) == 0;
+	if (valid) {
+		replay->num_frames = (int)((size - magic_size) / sizeof(input_frame_t));
+		replay->frames = cf_alloc(sizeof(input_frame_t) * (replay->num_frames + 1));
+		memcpy(replay->frames, content + magic_size, size - magic_size);
+	}
+
+	cf_free(content);
+	return valid;
+}
+
+static bool
+input_replay_next(input_replay_t* replay, input_frame_t* input) {
+	if (replay->next_frame >= replay->num_frames) { return false; }
+
+	*input = replay->frames[replay->next_frame++];
+	return true;
+}
+
+static int
+compare_doubles(const void* lhs, const void* rhs) {
+	double a = *(const double*)lhs;
+	double b = *(const double*)rhs;
+	return (a > b) - (a < b);
+}
+
+static double
+input_replay_percentile(const double* sorted, int count, double percentile) {
+	if (count == 0) { return 0.0; }
+
+	int index = (int)((count - 1) * percentile + 0.5);
+	return sorted[index];
+}
+
+static void
+input_replay_report(input_replay_t* replay, uint64_t shape_hash) {
+	int count = alen(replay->frame_times);
+	if (count > 1) {
+		qsort(replay->frame_times, count, sizeof(double), compare_doubles);
+	}
+
+	printf("frames: %d\n", count);
+	printf("frame time p50: %.3f ms\n", input_replay_percentile(replay->frame_times, count, 0.50));
+	printf("frame time p90: %.3f ms\n", input_replay_percentile(replay->frame_times, count, 0.90));
+	printf("frame time p99: %.3f ms\n", input_replay_percentile(replay->frame_times, count, 0.99));
+	printf("frame time max: %.3f ms\n", input_replay_percentile(replay->frame_times, count, 1.00));
+	printf("shape hash: %016" PRIx64 "\n", shape_hash);
+}
+
+static void
+input_replay_cleanup(input_replay_t* replay) {
+	cf_free(replay->frames);
+	afree(replay->frame_times);
+}
+
+#endif
+
 static void
 mouse_drag_point(CF_Coroutine coro) {
 	mouse_drag_info_t drag_info = *(mouse_drag_info_t*)cf_coroutine_get_udata(coro);
+	const input_frame_t* input = drag_info.input;
 	CF_V2 original_value = *drag_info.point;
-	CF_V2 original_mouse_pos = { cf_mouse_x(), cf_mouse_y() };
+	CF_V2 original_mouse_pos = { input->mouse_x, input->mouse_y };
 
-	while (cf_mouse_down(drag_info.button)) {
-		CF_V2 mouse_pos = { cf_mouse_x(), cf_mouse_y() };
+	while (input_button_down(input, drag_info.button)) {
+		CF_V2 mouse_pos = { input->mouse_x, input->mouse_y };
 		CF_V2 mouse_delta = cf_sub(mouse_pos, original_mouse_pos);
 		mouse_delta.y = -mouse_delta.y;
 		CF_V2 point_delta = cf_div(mouse_delta, drag_info.scale);
@@ -212,294 +948,4370 @@ start_mouse_drag(CF_Coroutine* modal_coro, mouse_drag_info_t* drag_info) {
 	start_modal(modal_coro, mouse_drag_point, drag_info);
 }
 
-static shape_t*
-commit_shape(shape_history_t* history) {
-	shape_history_entry_t* current_entry = &history->entries[history->current_index];
-	int next_index = (history->current_index + 1) % MAX_HISTORY_ENTRIES;
-	history->entries[next_index] = *current_entry;
-	history->entries[next_index].version = ++history->current_version;
-	history->current_index = next_index;
-	return &history->entries[next_index].shape;
+static vertex_chunk_t*
+history_make_chunk(shape_history_t* history, const CF_V2* verts, int num_vertices) {
+	size_t size = sizeof(vertex_chunk_t) + sizeof(CF_V2) * num_vertices;
+	vertex_chunk_t* chunk = cf_alloc(size);
+	chunk->ref_count = 1;
+	chunk->num_vertices = num_vertices;
+	memcpy(chunk->verts, verts, sizeof(CF_V2) * num_vertices);
+
+	++history->num_chunks;
+	history->chunk_bytes += size;
+	return chunk;
 }
 
-static shape_t*
-current_shape(shape_history_t* history) {
-	return &history->entries[history->current_index].shape;
+static void
+history_release_chunk(shape_history_t* history, vertex_chunk_t* chunk) {
+	if (--chunk->ref_count == 0) {
+		--history->num_chunks;
+		history->chunk_bytes -= sizeof(vertex_chunk_t) + sizeof(CF_V2) * chunk->num_vertices;
+		cf_free(chunk);
+	}
 }
 
-static uint64_t
-current_shape_version(shape_history_t* history) {
-	return history->entries[history->current_index].version;
-}
+static shape_node_t*
+history_make_node(shape_history_t* history, shape_node_t* parent) {
+	shape_node_t* node = cf_alloc(sizeof(shape_node_t));
+	*node = (shape_node_t){
+		.parent = parent,
+		.version = parent != NULL ? ++history->current_version : 0,
+	};
 
-static CF_Sprite
-load_sprite(const char* path, const void* content, size_t size) {
-	if (str_ends_with(path, ".ase") || str_ends_with(path, ".asperite")) {
-		return cf_make_sprite_from_memory(
-			path,
-			content, (int)size
-		);
-	} else if (str_ends_with(path, ".png")) {
-		CF_Sprite sprite = cf_sprite_defaults();
-		CF_Image img;
-		CF_Result result = cf_image_load_png_from_memory(content, (int)size, &img);
-		if (!cf_is_error(result)) {
-			sprite = cf_make_easy_sprite_from_pixels(img.pix, img.w, img.h);
-			cf_image_premultiply(&img);
+	if (parent != NULL) {
+		node->num_vertices = parent->num_vertices;
+		for (int i = 0; i < alen(parent->chunks); ++i) {
+			++parent->chunks[i]->ref_count;
+			apush(node->chunks, parent->chunks[i]);
 		}
-		cf_image_free(&img);
-		return sprite;
-	} else {
-		return cf_sprite_defaults();
+
+		node->next_sibling = parent->first_child;
+		parent->first_child = node;
+		parent->redo_child = node;
 	}
+
+	++history->num_nodes;
+	return node;
 }
 
-static char* title_buf = NULL;
+// Store the working copy into the current node.
+// Only the chunks covering the edited range are replaced, the rest are
+// shared with the previous content.
 static void
-set_title(const document_t* doc, uint64_t current_version) {
-	const char* title = doc->filename;
-	if (title == NULL) { title = "untitled"; }
+history_freeze(shape_history_t* history) {
+	shape_node_t* node = history->current;
+	const shape_t* shape = &history->working;
+	int num_chunks = alen(node->chunks);
+
+	int head = 0;
+	int head_verts = 0;
+	while (head < num_chunks) {
+		vertex_chunk_t* chunk = node->chunks[head];
+		if (
+			head_verts + chunk->num_vertices > shape->num_vertices
+			||
+			memcmp(chunk->verts, &shape->verts[head_verts], sizeof(CF_V2) * chunk->num_vertices) != 0
+		) {
+			break;
+		}
+		head_verts += chunk->num_vertices;
+		++head;
+	}
 
-	if (doc->saved_version != current_version) {
-		int size = snprintf(NULL, 0, "%s *", title);
-		title_buf = cf_realloc(title_buf, size + 1);
-		snprintf(title_buf, size + 1, "%s *", title);
-		cf_app_set_title(title_buf);
-	} else {
-		cf_app_set_title(title);
+	if (head == num_chunks && head_verts == shape->num_vertices) { return; }
+
+	int tail = num_chunks;
+	int tail_verts = 0;
+	while (tail > head) {
+		vertex_chunk_t* chunk = node->chunks[tail - 1];
+		int start = shape->num_vertices - tail_verts - chunk->num_vertices;
+		if (
+			start < head_verts
+			||
+			memcmp(chunk->verts, &shape->verts[start], sizeof(CF_V2) * chunk->num_vertices) != 0
+		) {
+			break;
+		}
+		tail_verts += chunk->num_vertices;
+		--tail;
+	}
+
+	// Absorb small neighbours so repeated edits don't fragment the chunks
+	if (head > 0 && node->chunks[head - 1]->num_vertices < HISTORY_CHUNK_SIZE / 2) {
+		--head;
+		head_verts -= node->chunks[head]->num_vertices;
+	}
+	if (tail < num_chunks && node->chunks[tail]->num_vertices < HISTORY_CHUNK_SIZE / 2) {
+		tail_verts -= node->chunks[tail]->num_vertices;
+		++tail;
+	}
+
+	dyna vertex_chunk_t** chunks = NULL;
+	afit(chunks, head + (num_chunks - tail) + 1);
+	for (int i = 0; i < head; ++i) {
+		apush(chunks, node->chunks[i]);
+	}
+	int end = shape->num_vertices - tail_verts;
+	for (int i = head_verts; i < end; i += HISTORY_CHUNK_SIZE) {
+		int count = end - i < HISTORY_CHUNK_SIZE ? end - i : HISTORY_CHUNK_SIZE;
+		apush(chunks, history_make_chunk(history, &shape->verts[i], count));
+	}
+	for (int i = tail; i < num_chunks; ++i) {
+		apush(chunks, node->chunks[i]);
+	}
+
+	for (int i = head; i < tail; ++i) {
+		history_release_chunk(history, node->chunks[i]);
 	}
+	afree(node->chunks);
+	node->chunks = chunks;
+	node->num_vertices = shape->num_vertices;
 }
 
 static void
-show_text_popup(text_popup_t* popup, const char* message) {
-	popup->message = message;
-	ImGui_OpenPopupID(popup->id, ImGuiPopupFlags_None);
+history_checkout(shape_history_t* history, shape_node_t* node) {
+	history->current = node;
+
+	shape_t* shape = &history->working;
+	shape->num_vertices = 0;
+	for (int i = 0; i < alen(node->chunks); ++i) {
+		vertex_chunk_t* chunk = node->chunks[i];
+		memcpy(&shape->verts[shape->num_vertices], chunk->verts, sizeof(CF_V2) * chunk->num_vertices);
+		shape->num_vertices += chunk->num_vertices;
+	}
 }
 
-static save_result_t
-pick_save_target(text_popup_t* text_popup, document_t* doc) {
-#ifndef __EMSCRIPTEN__
-	nfdu8char_t* path = NULL;
-	nfdu8filteritem_t filters[] = {
-		{
-			.name = "JSON",
-			.spec = "json",
+static void
+history_cleanup(shape_history_t* history) {
+	// Iterative so long linear histories can't blow the stack
+	dyna shape_node_t** stack = NULL;
+	if (history->root != NULL) {
+		apush(stack, history->root);
+	}
+	while (alen(stack) > 0) {
+		shape_node_t* node = apop(stack);
+		for (shape_node_t* child = node->first_child; child != NULL; child = child->next_sibling) {
+			apush(stack, child);
 		}
-	};
-	nfdresult_t save_result = NFD_SaveDialogU8(
-		&path,
-		filters, sizeof(filters) / sizeof(filters[0]),
-		NULL,
-		NULL
+
+		for (int i = 0; i < alen(node->chunks); ++i) {
+			history_release_chunk(history, node->chunks[i]);
+		}
+		afree(node->chunks);
+		cf_free(node);
+	}
+	afree(stack);
+}
+
+static void
+history_reset(shape_history_t* history) {
+	uint64_t generation = history->generation;
+	history_cleanup(history);
+	*history = (shape_history_t){ .generation = generation + 1 };
+	history->root = history->current = history_make_node(history, NULL);
+}
+
+static shape_t*
+commit_shape(shape_history_t* history) {
+	history_freeze(history);
+	history->current = history_make_node(history, history->current);
+	return &history->working;
+}
+
+static shape_t*
+current_shape(shape_history_t* history) {
+	return &history->working;
+}
+
+static uint64_t
+current_shape_version(shape_history_t* history) {
+	return history->current->version;
+}
+
+static bool
+history_undo(shape_history_t* history) {
+	shape_node_t* parent = history->current->parent;
+	if (parent == NULL) { return false; }
+
+	history_freeze(history);
+	parent->redo_child = history->current;
+	history_checkout(history, parent);
+	return true;
+}
+
+static bool
+history_redo(shape_history_t* history) {
+	shape_node_t* child = history->current->redo_child;
+	if (child == NULL) { return false; }
+
+	history_freeze(history);
+	history_checkout(history, child);
+	return true;
+}
+
+static void
+history_jump(shape_history_t* history, shape_node_t* node) {
+	history_freeze(history);
+
+	// Make redo retrace the path to the target
+	for (shape_node_t* itr = node; itr->parent != NULL; itr = itr->parent) {
+		itr->parent->redo_child = itr;
+	}
+	history_checkout(history, node);
+}
+
+static bool
+shape_insert_vertex(shape_t* shape, int index, CF_V2 vert) {
+	if (index < 0 || index > shape->num_vertices || shape->num_vertices >= MAX_NUM_VERTICES) {
+		return false;
+	}
+
+	memmove(
+		&shape->verts[index + 1],
+		&shape->verts[index],
+		(shape->num_vertices - index) * sizeof(shape->verts[0])
 	);
+	shape->verts[index] = vert;
+	++shape->num_vertices;
+	return true;
+}
 
-	if (save_result == NFD_OKAY) {
-		cf_free(doc->filename);
-		if (str_ends_with(path, ".json")) {
-			doc->filename = strclone(path);
+static bool
+shape_remove_vertex(shape_t* shape, int index) {
+	if (index < 0 || index >= shape->num_vertices) { return false; }
+
+	memmove(
+		&shape->verts[index],
+		&shape->verts[index + 1],
+		(shape->num_vertices - index - 1) * sizeof(shape->verts[0])
+	);
+	--shape->num_vertices;
+	return true;
+}
+
+// Sized from the input frame so a replay sees the recorded view
+static CF_Aabb
+visible_world_bounds(const input_frame_t* input, float padding) {
+	CF_V2 a = cf_screen_to_world(cf_v2(0.f, 0.f));
+	CF_V2 b = cf_screen_to_world(cf_v2((float)input->width, (float)input->height));
+	CF_V2 pad = { padding, padding };
+	return cf_make_aabb(cf_sub(cf_min(a, b), pad), cf_add(cf_max(a, b), pad));
+}
+
+static void
+handle_batch_begin(handle_batch_t* batch, CF_Aabb view) {
+	batch->view = view;
+	aclear(batch->positions);
+	aclear(batch->indices);
+}
+
+static void
+handle_batch_add(handle_batch_t* batch, CF_V2 pos, int index) {
+	// Off-screen handles are neither drawn nor hit-tested
+	if (
+		pos.x < batch->view.min.x || pos.x > batch->view.max.x
+		||
+		pos.y < batch->view.min.y || pos.y > batch->view.max.y
+	) {
+		return;
+	}
+
+	apush(batch->positions, pos);
+	apush(batch->indices, index);
+}
+
+static int
+handle_batch_pick(const handle_batch_t* batch, CF_V2 point, float radius) {
+	// The last handle wins, matching the draw order
+	for (int i = alen(batch->positions) - 1; i >= 0; --i) {
+		if (cf_len(cf_sub(batch->positions[i], point)) <= radius) {
+			return batch->indices[i];
+		}
+	}
+
+	return -1;
+}
+
+static void
+handle_batch_draw(const handle_batch_t* batch, int hovered_index, float radius) {
+	// Group by color so the whole batch costs one color change per group
+	// instead of a push/pop pair per handle
+	CF_Color color = cf_color_white();
+	color.a = 0.5f;
+	cf_draw_push_color(color);
+	int hovered_pos = -1;
+	for (int i = 0; i < alen(batch->positions); ++i) {
+		if (batch->indices[i] == hovered_index) {
+			hovered_pos = i;
 		} else {
-			doc->filename = strprintf("%s.json", path);
+			cf_draw_circle_fill2(batch->positions[i], radius);
 		}
+	}
+	cf_draw_pop_color();
+
+	if (hovered_pos >= 0) {
+		color = cf_color_green();
+		color.a = 0.5f;
+		cf_draw_push_color(color);
+		cf_draw_circle_fill2(batch->positions[hovered_pos], radius);
+		cf_draw_pop_color();
+	}
+}
 
-		NFD_FreePathU8(path);
-		return SAVE_OK;
-	} else if (save_result == NFD_ERROR) {
-		show_text_popup(text_popup, NFD_GetError());
-		return SAVE_ERROR;
-	} else {
-		return SAVE_CANCELLED;
+static void
+handle_batch_cleanup(handle_batch_t* batch) {
+	afree(batch->positions);
+	afree(batch->indices);
+}
+
+static void
+polyline_lod_invalidate(polyline_lod_t* lod) {
+	for (int i = 0; i < MAX_LOD_LEVELS; ++i) {
+		lod->levels[i].valid = false;
 	}
-#else
-	return SAVE_OK;
-#endif
 }
 
-typedef struct {
-	text_popup_t* text_popup;
-	document_t* doc;
-	shape_history_t* history;
-} doc_modal_ctx_t;
+static void
+polyline_lod_simplify_range(
+	polyline_lod_t* lod,
+	const CF_V2* verts, int n,
+	int first, int last,
+	float tolerance_sq
+) {
+	// Iterative Douglas-Peucker so dense outlines can't blow the stack.
+	// Indices wrap around so the closing half of the outline can be handled
+	// without copying.
+
+	apush(lod->stack, first);
+	apush(lod->stack, last);
+	while (alen(lod->stack) > 0) {
+		int end = apop(lod->stack);
+		int start = apop(lod->stack);
+		CF_V2 a = verts[start % n];
+		CF_V2 b = verts[end % n];
+
+		float max_distance_sq = 0.f;
+		int max_index = -1;
+		for (int i = start + 1; i < end; ++i) {
+			float distance_sq = point_to_segment_distance_squared(verts[i % n], a, b);
+			if (distance_sq > max_distance_sq) {
+				max_distance_sq = distance_sq;
+				max_index = i;
+			}
+		}
 
-static save_result_t
-do_save_doc(doc_modal_ctx_t* ctx) {
-	CF_JDoc jdoc = cf_make_json(NULL, 0);
-	CF_JVal root = cf_json_object(jdoc);
-	cf_json_set_root(jdoc, root);
+		if (max_index >= 0 && max_distance_sq > tolerance_sq) {
+			lod->keep[max_index % n] = true;
+			apush(lod->stack, start);
+			apush(lod->stack, max_index);
+			apush(lod->stack, max_index);
+			apush(lod->stack, end);
+		}
+	}
+}
 
-	cf_json_object_add_string(jdoc, root, "type", "polygon");
+static void
+polyline_lod_build(
+	polyline_lod_t* lod,
+	dyna CF_V2** out,
+	const CF_V2* verts, int num_vertices,
+	float tolerance
+) {
+	aclear(lod->keep);
+	for (int i = 0; i < num_vertices; ++i) {
+		apush(lod->keep, false);
+	}
 
-	CF_JVal verts = cf_json_array(jdoc);
-	cf_json_object_add(jdoc, root, "vertices", verts);
+	// Split the closed outline at the vertex farthest from the first one
+	int split = 0;
+	float split_distance_sq = 0.f;
+	for (int i = 1; i < num_vertices; ++i) {
+		CF_V2 d = cf_sub(verts[i], verts[0]);
+		float distance_sq = cf_dot(d, d);
+		if (distance_sq > split_distance_sq) {
+			split_distance_sq = distance_sq;
+			split = i;
+		}
+	}
 
-	shape_t* shape = current_shape(ctx->history);
-	for (int i = 0; i < shape->num_vertices; ++i) {
-		float data[] = { shape->verts[i].x, shape->verts[i].y };
-		CF_JVal vert = cf_json_array_from_float(
-			jdoc, data, sizeof(data) / sizeof(data[0])
-		);
-		cf_json_array_add(verts, vert);
+	lod->keep[0] = true;
+	lod->keep[split] = true;
+	float tolerance_sq = tolerance * tolerance;
+	polyline_lod_simplify_range(lod, verts, num_vertices, 0, split, tolerance_sq);
+	polyline_lod_simplify_range(lod, verts, num_vertices, split, num_vertices, tolerance_sq);
+
+	aclear(*out);
+	for (int i = 0; i < num_vertices; ++i) {
+		if (lod->keep[i]) {
+			apush(*out, verts[i]);
+		}
 	}
+}
 
-	save_result_t save_result = SAVE_OK;
-	dyna char* content = cf_json_to_string(jdoc);
-	if (!save_into_file(ctx->doc->filename, content, slen(content))) {
-		show_text_popup(ctx->text_popup, "Could not save file");
-		save_result = SAVE_ERROR;
+// Returns an outline whose error is below LOD_PIXEL_ERROR on screen.
+// The stored shape is never modified. Versions restart with every document
+// and every load, so the cache is keyed on all three.
+static const CF_V2*
+polyline_lod_select(
+	polyline_lod_t* lod,
+	uint64_t doc_id,
+	shape_history_t* history,
+	float draw_scale,
+	int* num_vertices
+) {
+	const shape_t* shape = current_shape(history);
+	*num_vertices = shape->num_vertices;
+	if (shape->num_vertices <= 3 || draw_scale <= 0.f) {
+		return shape->verts;
 	}
-	sfree(content);
 
-	cf_destroy_json(jdoc);
+	uint64_t version = current_shape_version(history);
+	if (lod->doc_id != doc_id || lod->generation != history->generation || lod->version != version) {
+		lod->doc_id = doc_id;
+		lod->generation = history->generation;
+		lod->version = version;
+		polyline_lod_invalidate(lod);
+	}
 
-	if (save_result == SAVE_OK) {
-		ctx->doc->saved_version = current_shape_version(ctx->history);
+	// Levels are power of two steps so zooming only moves between a few
+	// cached outlines. Pick the coarsest level that is still sub-pixel.
+	float tolerance = LOD_PIXEL_ERROR / draw_scale;
+	if (tolerance < LOD_PIXEL_ERROR) {
+		return shape->verts;
+	}
+	int level_index = (int)floorf(log2f(tolerance / LOD_PIXEL_ERROR)) + 1;
+	if (level_index >= MAX_LOD_LEVELS) { level_index = MAX_LOD_LEVELS - 1; }
+
+	polyline_lod_level_t* level = &lod->levels[level_index];
+	if (!level->valid) {
+		float level_tolerance = LOD_PIXEL_ERROR * (float)(1 << (level_index - 1));
+		polyline_lod_build(lod, &level->verts, shape->verts, shape->num_vertices, level_tolerance);
+		level->valid = true;
 	}
 
-	return save_result;
+	*num_vertices = alen(level->verts);
+	return level->verts;
 }
 
-static save_result_t
-save_doc_as(doc_modal_ctx_t* ctx) {
-	save_result_t save_result;
-	if ((save_result = pick_save_target(ctx->text_popup, ctx->doc)) == SAVE_OK) {
-		return do_save_doc(ctx);
-	} else {
-		return save_result;
+static void
+polyline_lod_cleanup(polyline_lod_t* lod) {
+	for (int i = 0; i < MAX_LOD_LEVELS; ++i) {
+		afree(lod->levels[i].verts);
 	}
+	afree(lod->stack);
+	afree(lod->keep);
 }
 
-static save_result_t
-save_doc(doc_modal_ctx_t* ctx) {
-	if (ctx->doc->filename == NULL) {
-		return save_doc_as(ctx);
-	} else {
-		return do_save_doc(ctx);
+static void
+history_browser_branch(shape_history_t* history, shape_node_t* node, shape_node_t** jump_target) {
+	// Linear runs are listed flat, only forks are nested
+	char label[64];
+	while (node != NULL) {
+		int num_vertices = node == history->current
+			? history->working.num_vertices
+			: node->num_vertices;
+		snprintf(
+			label, sizeof(label),
+			"#%llu: %d vertices",
+			(unsigned long long)node->version, num_vertices
+		);
+		ImGui_PushIDPtr(node);
+		if (ImGui_SelectableEx(label, node == history->current, ImGuiSelectableFlags_None, (ImVec2){ 0.f, 0.f })) {
+			*jump_target = node;
+		}
+		ImGui_PopID();
+
+		shape_node_t* child = node->first_child;
+		if (child == NULL || child->next_sibling == NULL) {
+			node = child;
+			continue;
+		}
+
+		for (; child != NULL; child = child->next_sibling) {
+			if (ImGui_TreeNodeExPtr(child, ImGuiTreeNodeFlags_DefaultOpen, "Branch #%llu", (unsigned long long)child->version)) {
+				history_browser_branch(history, child, jump_target);
+				ImGui_TreePop();
+			}
+		}
+		break;
 	}
 }
 
-typedef enum {
-	MODAL_CHOICE_NONE,
-	MODAL_CHOICE_YES,
-	MODAL_CHOICE_NO,
-	MODAL_CHOICE_CANCEL,
-} modal_choice_t;
+static shape_node_t*
+history_browser(shape_history_t* history, bool* open) {
+	shape_node_t* jump_target = NULL;
+	if (ImGui_Begin("History", open, ImGuiWindowFlags_None)) {
+		ImGui_Text(
+			"%d states, %d chunks, %.1f KiB",
+			history->num_nodes,
+			history->num_chunks,
+			(double)history->chunk_bytes / 1024.0
+		);
+		ImGui_Separator();
+		history_browser_branch(history, history->root, &jump_target);
+	}
+	ImGui_End();
 
-static modal_choice_t
-modal_confirm(CF_Coroutine coro, const char* message, bool may_cancel) {
-	ImGui_OpenPopup("Confirmation", ImGuiPopupFlags_AnyPopup);
+	return jump_target;
+}
 
-	modal_choice_t choice = MODAL_CHOICE_NONE;
-	while (choice == MODAL_CHOICE_NONE) {
-		if (ImGui_BeginPopupModal("Confirmation", NULL, ImGuiWindowFlags_AlwaysAutoResize)) {
-			ImGui_Text("%s", message);
-			if (ImGui_Button("Yes")) {
-				choice = MODAL_CHOICE_YES;
+// Fit metrics
+//
+// The shape is rasterized with an even-odd scanline fill at pixel centers,
+// in the same space the sprite is drawn in: centered on the origin, y up.
+// Per row counts are kept so an edit only re-rasterizes the rows crossed by
+// the edges that changed.
+
+static void
+fit_metrics_clear(fit_metrics_t* fit) {
+	for (int i = 0; i < fit->height; ++i) {
+		afree(fit->rows[i].spans);
+	}
+	cf_free(fit->mask);
+	cf_free(fit->coverage);
+	cf_free(fit->rows);
+	afree(fit->verts);
+	afree(fit->crossings);
+	*fit = (fit_metrics_t){ 0 };
+}
+
+static size_t
+fit_mask_size(int width, int height) {
+	return sizeof(uint64_t) * (size_t)((width + 63) / 64) * (size_t)height;
+}
+
+// One bit per pixel, rows padded to whole words
+static uint64_t*
+fit_build_mask(const void* rgba, int width, int height) {
+	if (rgba == NULL || width <= 0 || height <= 0) { return NULL; }
+
+	int words_per_row = (width + 63) / 64;
+	uint64_t* mask = cf_calloc((size_t)words_per_row * height, sizeof(uint64_t));
+	const uint8_t* pixels = rgba;
+	for (int y = 0; y < height; ++y) {
+		uint64_t* row = &mask[(size_t)y * words_per_row];
+		for (int x = 0; x < width; ++x) {
+			if (pixels[((size_t)y * width + x) * 4 + 3] >= FIT_ALPHA_THRESHOLD) {
+				row[x / 64] |= 1ull << (x % 64);
 			}
+		}
+	}
 
-			if (ImGui_Button("No")) {
-				choice = MODAL_CHOICE_NO;
+	return mask;
+}
+
+static void
+fit_metrics_set_mask(fit_metrics_t* fit, const uint64_t* mask, int width, int height) {
+	fit_metrics_clear(fit);
+	if (mask == NULL || width <= 0 || height <= 0) { return; }
+
+	fit->width = width;
+	fit->height = height;
+	fit->words_per_row = (width + 63) / 64;
+	size_t num_words = (size_t)fit->words_per_row * height;
+	fit->mask = cf_alloc(sizeof(uint64_t) * num_words);
+	memcpy(fit->mask, mask, sizeof(uint64_t) * num_words);
+	fit->coverage = cf_calloc(num_words, sizeof(uint64_t));
+	fit->rows = cf_calloc(height, sizeof(fit_row_t));
+}
+
+static bool
+fit_metrics_available(const fit_metrics_t* fit) {
+	return fit->mask != NULL;
+}
+
+static float
+fit_row_center_y(const fit_metrics_t* fit, int row) {
+	return (float)fit->height * 0.5f - (float)row - 0.5f;
+}
+
+static uint64_t
+fit_wrong_bits(const uint64_t* coverage, const uint64_t* mask, int word, bool false_positive) {
+	return false_positive ? coverage[word] & ~mask[word] : ~coverage[word] & mask[word];
+}
+
+// Empty words are skipped whole and both ends of a run are found with a
+// bit scan, so a row costs its words plus its runs rather than its width.
+// Padding bits are clear in both coverage and mask, so runs stop at width.
+static void
+fit_find_spans(
+	fit_metrics_t* fit,
+	fit_row_t* row,
+	const uint64_t* coverage, const uint64_t* mask,
+	bool false_positive
+) {
+	int num_words = fit->words_per_row;
+	int word = 0;
+	uint64_t bits = fit_wrong_bits(coverage, mask, word, false_positive);
+	while (true) {
+		while (bits == 0 && ++word < num_words) {
+			bits = fit_wrong_bits(coverage, mask, word, false_positive);
+		}
+		if (bits == 0) { return; }
+		int start = word * 64 + count_trailing_zeros64(bits);
+
+		// First clear bit after the start of the run
+		uint64_t gaps = ~bits & (~0ull << (start % 64));
+		while (gaps == 0 && ++word < num_words) {
+			gaps = ~fit_wrong_bits(coverage, mask, word, false_positive);
+		}
+		int end = gaps != 0 ? word * 64 + count_trailing_zeros64(gaps) : num_words * 64;
+		if (end > fit->width) { end = fit->width; }
+		apush(row->spans, (fit_span_t){ .start = start, .end = end, .false_positive = false_positive });
+		if (gaps == 0) { return; }
+
+		bits = fit_wrong_bits(coverage, mask, word, false_positive) & (~0ull << (end % 64));
+	}
+}
+
+static void
+fit_rasterize_row(fit_metrics_t* fit, const shape_t* shape, int row_index) {
+	uint64_t* coverage = &fit->coverage[(size_t)row_index * fit->words_per_row];
+	const uint64_t* mask = &fit->mask[(size_t)row_index * fit->words_per_row];
+	memset(coverage, 0, sizeof(uint64_t) * fit->words_per_row);
+
+	// Crossings of the scanline, sorted
+	float y = fit_row_center_y(fit, row_index);
+	aclear(fit->crossings);
+	int n = shape->num_vertices;
+	for (int i = 0; n >= 3 && i < n; ++i) {
+		CF_V2 a = shape->verts[i];
+		CF_V2 b = shape->verts[(i + 1) % n];
+		if ((a.y <= y) != (b.y <= y)) {
+			float x = a.x + (y - a.y) * (b.x - a.x) / (b.y - a.y);
+			apush(fit->crossings, x);
+			for (int j = alen(fit->crossings) - 1; j > 0 && fit->crossings[j - 1] > fit->crossings[j]; --j) {
+				float tmp = fit->crossings[j];
+				fit->crossings[j] = fit->crossings[j - 1];
+				fit->crossings[j - 1] = tmp;
 			}
+		}
+	}
 
-			if (may_cancel && ImGui_Button("Cancel")) {
-				choice = MODAL_CHOICE_CANCEL;
+	// Fill between pairs of crossings, pixel x is covered if its center is
+	float half_width = (float)fit->width * 0.5f;
+	for (int i = 0; i + 1 < alen(fit->crossings); i += 2) {
+		int start = (int)ceilf(fit->crossings[i] + half_width - 0.5f);
+		int end = (int)ceilf(fit->crossings[i + 1] + half_width - 0.5f);
+		if (start < 0) { start = 0; }
+		if (end > fit->width) { end = fit->width; }
+		for (int x = start; x < end;) {
+			int bit = x % 64;
+			int count = end - x < 64 - bit ? end - x : 64 - bit;
+			uint64_t bits = count == 64 ? ~0ull : ((1ull << count) - 1) << bit;
+			coverage[x / 64] |= bits;
+			x += count;
+		}
+	}
+
+	// Counts, a word at a time
+	fit_row_t* row = &fit->rows[row_index];
+	row->true_positive = row->false_positive = row->false_negative = 0;
+	for (int i = 0; i < fit->words_per_row; ++i) {
+		row->true_positive += popcount64(coverage[i] & mask[i]);
+		row->false_positive += popcount64(coverage[i] & ~mask[i]);
+		row->false_negative += popcount64(~coverage[i] & mask[i]);
+	}
+
+	// Runs of wrong pixels for the heatmap
+	aclear(row->spans);
+	if (row->false_positive > 0) {
+		fit_find_spans(fit, row, coverage, mask, true);
+	}
+	if (row->false_negative > 0) {
+		fit_find_spans(fit, row, coverage, mask, false);
+	}
+}
+
+static void
+fit_add_edge_rows(const fit_metrics_t* fit, const CF_V2* verts, int n, int edge, float* min_y, float* max_y) {
+	edge = ((edge % n) + n) % n;
+	CF_V2 a = verts[edge];
+	CF_V2 b = verts[(edge + 1) % n];
+	*min_y = fminf(*min_y, fminf(a.y, b.y));
+	*max_y = fmaxf(*max_y, fmaxf(a.y, b.y));
+}
+
+static void
+fit_metrics_update(fit_metrics_t* fit, const shape_t* shape) {
+	if (!fit_metrics_available(fit)) { return; }
+
+	int first_row = 0;
+	int last_row = fit->height - 1;
+	int old_n = alen(fit->verts);
+	int new_n = shape->num_vertices;
+	if (fit->valid && old_n >= 3 && new_n >= 3) {
+		// Only edges touching the changed vertices can change a row
+		int limit = old_n < new_n ? old_n : new_n;
+		int prefix = 0;
+		while (prefix < limit && memcmp(&fit->verts[prefix], &shape->verts[prefix], sizeof(CF_V2)) == 0) {
+			++prefix;
+		}
+		if (prefix == old_n && old_n == new_n) { return; }
+
+		int suffix = 0;
+		while (
+			suffix < limit - prefix
+			&&
+			memcmp(&fit->verts[old_n - suffix - 1], &shape->verts[new_n - suffix - 1], sizeof(CF_V2)) == 0
+		) {
+			++suffix;
+		}
+
+		float min_y = INFINITY;
+		float max_y = -INFINITY;
+		for (int i = prefix - 1; i <= old_n - suffix - 1; ++i) {
+			fit_add_edge_rows(fit, fit->verts, old_n, i, &min_y, &max_y);
+		}
+		for (int i = prefix - 1; i <= new_n - suffix - 1; ++i) {
+			fit_add_edge_rows(fit, shape->verts, new_n, i, &min_y, &max_y);
+		}
+
+		first_row = (int)floorf((float)fit->height * 0.5f - max_y - 0.5f);
+		last_row = (int)ceilf((float)fit->height * 0.5f - min_y - 0.5f);
+		if (first_row < 0) { first_row = 0; }
+		if (last_row > fit->height - 1) { last_row = fit->height - 1; }
+	}
+
+	for (int i = first_row; i <= last_row; ++i) {
+		fit_row_t* row = &fit->rows[i];
+		fit->true_positive -= row->true_positive;
+		fit->false_positive -= row->false_positive;
+		fit->false_negative -= row->false_negative;
+		fit_rasterize_row(fit, shape, i);
+		fit->true_positive += row->true_positive;
+		fit->false_positive += row->false_positive;
+		fit->false_negative += row->false_negative;
+	}
+
+	aclear(fit->verts);
+	for (int i = 0; i < new_n; ++i) {
+		apush(fit->verts, shape->verts[i]);
+	}
+	fit->valid = true;
+}
+
+static float
+fit_metrics_iou(const fit_metrics_t* fit) {
+	int64_t union_size = fit->true_positive + fit->false_positive + fit->false_negative;
+	return union_size > 0 ? (float)((double)fit->true_positive / (double)union_size) : 1.f;
+}
+
+// Draw in sprite space: false positives in red, false negatives in blue
+static void
+fit_metrics_draw_heatmap(const fit_metrics_t* fit, CF_Aabb view) {
+	if (!fit_metrics_available(fit)) { return; }
+
+	float half_width = (float)fit->width * 0.5f;
+	int first_row = (int)floorf((float)fit->height * 0.5f - view.max.y - 0.5f);
+	int last_row = (int)ceilf((float)fit->height * 0.5f - view.min.y - 0.5f);
+	if (first_row < 0) { first_row = 0; }
+	if (last_row > fit->height - 1) { last_row = fit->height - 1; }
+
+	CF_Color colors[2] = {
+		cf_make_color_rgba_f(0.f, 0.3f, 1.f, 0.5f),
+		cf_make_color_rgba_f(1.f, 0.f, 0.f, 0.5f),
+	};
+	for (int pass = 0; pass < 2; ++pass) {
+		cf_draw_push_color(colors[pass]);
+		for (int i = first_row; i <= last_row; ++i) {
+			float y = fit_row_center_y(fit, i);
+			const fit_row_t* row = &fit->rows[i];
+			for (int j = 0; j < alen(row->spans); ++j) {
+				const fit_span_t* span = &row->spans[j];
+				if (span->false_positive != (pass == 1)) { continue; }
+
+				CF_V2 a = { (float)span->start - half_width, y };
+				CF_V2 b = { (float)span->end - half_width, y };
+				cf_draw_line(a, b, 1.f);
+			}
+		}
+		cf_draw_pop_color();
+	}
+}
+
+static void
+fit_metrics_window(const fit_metrics_t* fit, int num_frames, bool* open, bool* show_heatmap) {
+	if (ImGui_Begin("Fit quality", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+		if (fit_metrics_available(fit)) {
+			if (num_frames > 1) {
+				ImGui_Text("Measured against frame 1 of %d", num_frames);
+			}
+			ImGui_Text("IoU: %.4f", (double)fit_metrics_iou(fit));
+			ImGui_Text("False positive pixels: %lld", (long long)fit->false_positive);
+			ImGui_Text("False negative pixels: %lld", (long long)fit->false_negative);
+			ImGui_Checkbox("Heatmap", show_heatmap);
+		} else {
+			ImGui_Text("Load a png or aseprite sprite to measure the fit");
+		}
+	}
+	ImGui_End();
+}
+
+// Collision playground
+//
+// Throws bodies at the edited shape to show what it would cost at runtime.
+// Every edge of the shape is a zero radius capsule, which keeps concave
+// shapes working with the convex only c2 routines. Edges are binned once
+// into a static grid, bodies are binned again every step.
+//
+// Each task owns a slice of the bodies and only writes those, reading
+// everyone else from the previous step, so no locking is needed.
+
+static void
+playground_grid_build(
+	playground_grid_t* grid,
+	int num_cells,
+	int num_items,
+	void (*cells_of)(const playground_t* playground, int item, int* min_cell, int* max_cell),
+	const playground_t* playground
+) {
+	// Counting sort, once to size each cell and once to fill it
+	afit(grid->offsets, num_cells + 1);
+	aclear(grid->offsets);
+	for (int i = 0; i <= num_cells; ++i) {
+		apush(grid->offsets, 0);
+	}
+
+	for (int pass = 0; pass < 2; ++pass) {
+		for (int item = 0; item < num_items; ++item) {
+			int min_cell[2], max_cell[2];
+			cells_of(playground, item, min_cell, max_cell);
+			for (int y = min_cell[1]; y <= max_cell[1]; ++y) {
+				for (int x = min_cell[0]; x <= max_cell[0]; ++x) {
+					int cell = y * playground->grid_width + x;
+					if (pass == 0) {
+						++grid->offsets[cell + 1];
+					} else {
+						grid->items[grid->offsets[cell]++] = item;
+					}
+				}
+			}
+		}
+
+		if (pass == 0) {
+			for (int i = 0; i < num_cells; ++i) {
+				grid->offsets[i + 1] += grid->offsets[i];
+			}
+			aclear(grid->items);
+			afit(grid->items, grid->offsets[num_cells]);
+			for (int i = 0; i < grid->offsets[num_cells]; ++i) {
+				apush(grid->items, 0);
+			}
+		} else {
+			// Filling advanced every offset to the start of the next cell
+			for (int i = num_cells; i > 0; --i) {
+				grid->offsets[i] = grid->offsets[i - 1];
+			}
+			grid->offsets[0] = 0;
+		}
+	}
+}
+
+static void
+playground_grid_cleanup(playground_grid_t* grid) {
+	afree(grid->offsets);
+	afree(grid->items);
+}
+
+static int
+playground_cell_coord(const playground_t* playground, float value, float min, int size) {
+	int coord = (int)floorf((value - min) / playground->cell_size);
+	if (coord < 0) { return 0; }
+	if (coord > size - 1) { return size - 1; }
+	return coord;
+}
+
+static void
+playground_cell_of(const playground_t* playground, CF_V2 point, int* cell) {
+	cell[0] = playground_cell_coord(playground, point.x, playground->bounds.min.x, playground->grid_width);
+	cell[1] = playground_cell_coord(playground, point.y, playground->bounds.min.y, playground->grid_height);
+}
+
+// Edges go into every cell a body touching them could be centered in, so
+// bodies only ever look up their own cell
+static void
+playground_edge_cells(const playground_t* playground, int item, int* min_cell, int* max_cell) {
+	const CF_Capsule* edge = &playground->edges[item];
+	float reach = playground->grid_body_size * 1.5f;
+	CF_V2 min = { fminf(edge->a.x, edge->b.x) - reach, fminf(edge->a.y, edge->b.y) - reach };
+	CF_V2 max = { fmaxf(edge->a.x, edge->b.x) + reach, fmaxf(edge->a.y, edge->b.y) + reach };
+	playground_cell_of(playground, min, min_cell);
+	playground_cell_of(playground, max, max_cell);
+}
+
+static void
+playground_body_cells(const playground_t* playground, int item, int* min_cell, int* max_cell) {
+	playground_cell_of(playground, playground->bodies[item].pos, min_cell);
+	max_cell[0] = min_cell[0];
+	max_cell[1] = min_cell[1];
+}
+
+static void
+playground_spawn(playground_t* playground, playground_body_t* body, CF_Rnd* rnd, bool anywhere) {
+	CF_Aabb bounds = playground->bounds;
+	float top = bounds.max.y - playground->body_size;
+	body->pos = (CF_V2){
+		cf_rnd_range_float(rnd, bounds.min.x, bounds.max.x),
+		anywhere ? cf_rnd_range_float(rnd, bounds.min.y, top) : top,
+	};
+	body->vel = (CF_V2){ cf_rnd_range_float(rnd, -50.f, 50.f), 0.f };
+}
+
+static void
+playground_reset(playground_t* playground) {
+	for (int i = 0; i < PLAYGROUND_MAX_TASKS; ++i) {
+		playground->tasks[i].rnd = cf_rnd_seed((uint64_t)i + 2);
+	}
+
+	aclear(playground->bodies);
+	CF_Rnd rnd = cf_rnd_seed(1);
+	for (int i = 0; i < playground->num_bodies; ++i) {
+		playground_body_t body;
+		playground_spawn(playground, &body, &rnd, true);
+		apush(playground->bodies, body);
+	}
+}
+
+static void
+playground_set_shape(playground_t* playground, const shape_t* shape, uint64_t version) {
+	if (
+		playground->shape == shape
+		&&
+		playground->shape_version == version
+		&&
+		playground->grid_body_size == playground->body_size
+		&&
+		alen(playground->edge_grid.offsets) > 0
+	) {
+		return;
+	}
+	playground->shape = shape;
+	playground->shape_version = version;
+	playground->grid_body_size = playground->body_size;
+
+	aclear(playground->edges);
+	CF_Aabb bounds = cf_make_aabb((CF_V2){ -128.f, -128.f }, (CF_V2){ 128.f, 128.f });
+	if (shape->num_vertices >= 2) {
+		bounds = cf_make_aabb(shape->verts[0], shape->verts[0]);
+		for (int i = 0; i < shape->num_vertices; ++i) {
+			CF_V2 a = shape->verts[i];
+			CF_V2 b = shape->verts[(i + 1) % shape->num_vertices];
+			apush(playground->edges, ((CF_Capsule){ .a = a, .b = b, .r = 0.f }));
+			bounds.min = cf_min(bounds.min, a);
+			bounds.max = cf_max(bounds.max, a);
+		}
+	}
+
+	// Leave room around the shape for bodies to fall past it
+	float margin = fmaxf(
+		fmaxf(bounds.max.x - bounds.min.x, bounds.max.y - bounds.min.y) * 0.5f,
+		playground->body_size * 8.f
+	);
+	bounds.min = cf_sub(bounds.min, (CF_V2){ margin, margin });
+	bounds.max = cf_add(bounds.max, (CF_V2){ margin, margin });
+	playground->bounds = bounds;
+
+	float width = bounds.max.x - bounds.min.x;
+	float height = bounds.max.y - bounds.min.y;
+	playground->cell_size = fmaxf(
+		playground->body_size * 2.f,
+		fmaxf(width, height) / (float)PLAYGROUND_MAX_GRID
+	);
+	playground->grid_width = (int)ceilf(width / playground->cell_size);
+	playground->grid_height = (int)ceilf(height / playground->cell_size);
+
+	playground_grid_build(
+		&playground->edge_grid,
+		playground->grid_width * playground->grid_height,
+		alen(playground->edges),
+		playground_edge_cells,
+		playground
+	);
+}
+
+static CF_Manifold
+playground_body_vs_edge(const playground_t* playground, CF_V2 pos, const CF_Capsule* edge) {
+	float size = playground->body_size;
+	if (playground->kind == PLAYGROUND_CIRCLES) {
+		return cf_circle_to_capsule_manifold((CF_Circle){ .p = pos, .r = size }, *edge);
+	} else {
+		CF_Aabb box = cf_make_aabb(cf_sub(pos, (CF_V2){ size, size }), cf_add(pos, (CF_V2){ size, size }));
+		return cf_aabb_to_capsule_manifold(box, *edge);
+	}
+}
+
+static CF_Manifold
+playground_body_vs_body(const playground_t* playground, CF_V2 pos, CF_V2 other) {
+	float size = playground->body_size;
+	if (playground->kind == PLAYGROUND_CIRCLES) {
+		return cf_circle_to_circle_manifold(
+			(CF_Circle){ .p = pos, .r = size },
+			(CF_Circle){ .p = other, .r = size }
+		);
+	} else {
+		CF_V2 extent = { size, size };
+		return cf_aabb_to_aabb_manifold(
+			cf_make_aabb(cf_sub(pos, extent), cf_add(pos, extent)),
+			cf_make_aabb(cf_sub(other, extent), cf_add(other, extent))
+		);
+	}
+}
+
+// Pushes the body out along the contact normal, which points from the
+// body towards what it hit, and kills the velocity going into it
+static void
+playground_resolve(playground_body_t* body, const CF_Manifold* manifold, float share) {
+	float depth = manifold->depths[0];
+	if (manifold->count > 1 && manifold->depths[1] > depth) {
+		depth = manifold->depths[1];
+	}
+	body->pos = cf_sub(body->pos, cf_mul_v2_f(manifold->n, depth * share));
+
+	float speed = cf_dot(body->vel, manifold->n);
+	if (speed > 0.f) {
+		body->vel = cf_sub(body->vel, cf_mul_v2_f(manifold->n, speed * 1.5f));
+	}
+}
+
+// Each pass runs over the whole slice so that the clock is read once per
+// pass and not once per body, which would cost about as much as a test
+static void
+playground_step_task(void* udata) {
+	playground_task_t* task = udata;
+	playground_t* playground = task->playground;
+	const playground_grid_t* edge_grid = &playground->edge_grid;
+	const playground_grid_t* body_grid = &playground->body_grid;
+	const float dt = 1.f / 60.f;
+	int first = task->first_body;
+	int last = task->first_body + task->num_bodies;
+
+	task->shape_ticks = task->body_ticks = 0;
+	task->shape_tests = task->shape_contacts = task->body_tests = 0;
+
+	for (int i = first; i < last; ++i) {
+		playground_body_t* body = &playground->next_bodies[i];
+		body->vel.y -= PLAYGROUND_GRAVITY * dt;
+		body->pos = cf_add(body->pos, cf_mul_v2_f(body->vel, dt));
+	}
+
+	uint64_t start = cf_get_ticks();
+	for (int i = first; i < last; ++i) {
+		playground_body_t* body = &playground->next_bodies[i];
+		int cell[2];
+		playground_cell_of(playground, body->pos, cell);
+		int cell_index = cell[1] * playground->grid_width + cell[0];
+
+		for (int j = edge_grid->offsets[cell_index]; j < edge_grid->offsets[cell_index + 1]; ++j) {
+			const CF_Capsule* edge = &playground->edges[edge_grid->items[j]];
+			CF_Manifold manifold = playground_body_vs_edge(playground, body->pos, edge);
+			++task->shape_tests;
+			if (manifold.count > 0) {
+				++task->shape_contacts;
+				playground_resolve(body, &manifold, 1.f);
+			}
+		}
+	}
+	uint64_t end = cf_get_ticks();
+	task->shape_ticks = end - start;
+
+	if (playground->collide_bodies) {
+		for (int i = first; i < last; ++i) {
+			// Against where the others were at the start of the step, each
+			// side of a pair resolves half
+			playground_body_t* body = &playground->next_bodies[i];
+			CF_V2 pos = playground->bodies[i].pos;
+			int cell[2];
+			playground_cell_of(playground, pos, cell);
+			for (int y = cell[1] - 1; y <= cell[1] + 1; ++y) {
+				if (y < 0 || y >= playground->grid_height) { continue; }
+				for (int x = cell[0] - 1; x <= cell[0] + 1; ++x) {
+					if (x < 0 || x >= playground->grid_width) { continue; }
+					int neighbor_cell = y * playground->grid_width + x;
+					for (
+						int j = body_grid->offsets[neighbor_cell];
+						j < body_grid->offsets[neighbor_cell + 1];
+						++j
+					) {
+						int other = body_grid->items[j];
+						if (other == i) { continue; }
+
+						CF_Manifold manifold = playground_body_vs_body(
+							playground, pos, playground->bodies[other].pos
+						);
+						++task->body_tests;
+						if (manifold.count > 0) {
+							playground_resolve(body, &manifold, 0.5f);
+						}
+					}
+				}
+			}
+		}
+		task->body_ticks = cf_get_ticks() - end;
+	}
+
+	CF_Aabb bounds = playground->bounds;
+	for (int i = first; i < last; ++i) {
+		playground_body_t* body = &playground->next_bodies[i];
+		if (body->pos.y < bounds.min.y || body->pos.x < bounds.min.x || body->pos.x > bounds.max.x) {
+			playground_spawn(playground, body, &task->rnd, false);
+		}
+	}
+}
+
+// The web build has no worker threads, tasks run in place there
+static void
+playground_step(playground_t* playground) {
+	uint64_t start = cf_get_ticks();
+	int num_bodies = alen(playground->bodies);
+	playground_grid_build(
+		&playground->body_grid,
+		playground->grid_width * playground->grid_height,
+		num_bodies,
+		playground_body_cells,
+		playground
+	);
+
+	aclear(playground->next_bodies);
+	afit(playground->next_bodies, num_bodies);
+	for (int i = 0; i < num_bodies; ++i) {
+		apush(playground->next_bodies, playground->bodies[i]);
+	}
+
+	// A few tasks per core so uneven slices still balance out
+	int num_tasks = cf_core_count() * 4;
+	if (num_tasks > PLAYGROUND_MAX_TASKS) { num_tasks = PLAYGROUND_MAX_TASKS; }
+	int slice = (num_bodies + num_tasks - 1) / num_tasks;
+	playground->num_tasks = 0;
+	for (int first = 0; first < num_bodies; first += slice) {
+		playground_task_t* task = &playground->tasks[playground->num_tasks++];
+		task->playground = playground;
+		task->first_body = first;
+		task->num_bodies = num_bodies - first < slice ? num_bodies - first : slice;
+#ifndef __EMSCRIPTEN__
+		cf_threadpool_add_task(playground->pool, playground_step_task, task);
+#else
+		playground_step_task(task);
+#endif
+	}
+#ifndef __EMSCRIPTEN__
+	cf_threadpool_kick_and_wait(playground->pool);
+#endif
+
+	dyna playground_body_t* bodies = playground->bodies;
+	playground->bodies = playground->next_bodies;
+	playground->next_bodies = bodies;
+
+	// Stats
+	uint64_t shape_ticks = 0, body_ticks = 0;
+	int shape_tests = 0, shape_contacts = 0, body_tests = 0;
+	for (int i = 0; i < playground->num_tasks; ++i) {
+		const playground_task_t* task = &playground->tasks[i];
+		shape_ticks += task->shape_ticks;
+		body_ticks += task->body_ticks;
+		shape_tests += task->shape_tests;
+		shape_contacts += task->shape_contacts;
+		body_tests += task->body_tests;
+	}
+
+	double ns_per_tick = 1e9 / (double)cf_get_tick_frequency();
+	double step_ns = (double)(cf_get_ticks() - start) * ns_per_tick;
+	double shape_ns = (double)shape_ticks * ns_per_tick;
+	double body_ns = (double)body_ticks * ns_per_tick;
+	int num_vertices = playground->shape->num_vertices;
+
+	const double smoothing = 0.9;
+	playground->step_ms = playground->step_ms * smoothing + step_ns / 1e6 * (1.0 - smoothing);
+	playground->shape_tests_per_second = playground->shape_tests_per_second * smoothing
+		+ (step_ns > 0.0 ? shape_tests / (step_ns / 1e9) : 0.0) * (1.0 - smoothing);
+	playground->ns_per_shape_test = playground->ns_per_shape_test * smoothing
+		+ (shape_tests > 0 ? shape_ns / shape_tests : 0.0) * (1.0 - smoothing);
+	playground->ns_per_contact = playground->ns_per_contact * smoothing
+		+ (shape_contacts > 0 ? shape_ns / shape_contacts : 0.0) * (1.0 - smoothing);
+	playground->ns_per_body_test = playground->ns_per_body_test * smoothing
+		+ (body_tests > 0 ? body_ns / body_tests : 0.0) * (1.0 - smoothing);
+	playground->us_per_vertex = playground->us_per_vertex * smoothing
+		+ (num_vertices > 0 ? shape_ns / 1e3 / num_vertices : 0.0) * (1.0 - smoothing);
+	playground->shape_contacts = shape_contacts;
+	playground->body_tests = body_tests;
+}
+
+// Shapes edited in place, like during a drag, keep their version
+static void
+playground_invalidate(playground_t* playground) {
+	aclear(playground->edge_grid.offsets);
+}
+
+static void
+playground_update(playground_t* playground, const shape_t* shape, uint64_t version) {
+	playground_set_shape(playground, shape, version);
+	if (alen(playground->bodies) != playground->num_bodies) {
+		playground_reset(playground);
+	}
+
+	if (playground->running) {
+		playground_step(playground);
+	}
+}
+
+static void
+playground_draw(const playground_t* playground) {
+	if (!playground->draw_bodies) { return; }
+
+	float size = playground->body_size;
+	CF_Color color = cf_color_white();
+	color.a = 0.5f;
+	cf_draw_push_color(color);
+	for (int i = 0; i < alen(playground->bodies); ++i) {
+		CF_V2 pos = playground->bodies[i].pos;
+		if (playground->kind == PLAYGROUND_CIRCLES) {
+			cf_draw_circle_fill2(pos, size);
+		} else {
+			CF_V2 extent = { size, size };
+			cf_draw_box_fill(cf_make_aabb(cf_sub(pos, extent), cf_add(pos, extent)), 0.f);
+		}
+	}
+	cf_draw_pop_color();
+}
+
+static void
+playground_window(playground_t* playground, bool* open) {
+	if (ImGui_Begin("Playground", open, ImGuiWindowFlags_AlwaysAutoResize)) {
+		bool changed = false;
+		changed |= ImGui_RadioButtonIntPtr("Circles", &playground->kind, PLAYGROUND_CIRCLES);
+		ImGui_SameLine();
+		changed |= ImGui_RadioButtonIntPtr("Boxes", &playground->kind, PLAYGROUND_BOXES);
+		ImGui_SliderInt("Bodies", &playground->num_bodies, 1, PLAYGROUND_MAX_BODIES);
+		changed |= ImGui_SliderFloat("Size", &playground->body_size, 1.f, 16.f);
+		ImGui_Checkbox("Bodies collide", &playground->collide_bodies);
+		ImGui_Checkbox("Draw bodies", &playground->draw_bodies);
+		ImGui_Checkbox("Running", &playground->running);
+		if (ImGui_Button("Reset") || changed) {
+			playground_reset(playground);
+		}
+
+		ImGui_Separator();
+		ImGui_Text("Step: %.3f ms", playground->step_ms);
+		ImGui_Text("Edge tests: %.0f per second", playground->shape_tests_per_second);
+		ImGui_Text("Shape contacts: %d", playground->shape_contacts);
+		ImGui_Text("Narrowphase: %.1f ns per test", playground->ns_per_shape_test);
+		ImGui_Text("Narrowphase: %.1f ns per contact", playground->ns_per_contact);
+		ImGui_Text("Shape cost: %.2f us per vertex per step", playground->us_per_vertex);
+		ImGui_Text("Body pair tests: %d", playground->body_tests);
+		ImGui_Text("Body narrowphase: %.1f ns per test", playground->ns_per_body_test);
+	}
+	ImGui_End();
+}
+
+static void
+playground_cleanup(playground_t* playground) {
+	afree(playground->bodies);
+	afree(playground->next_bodies);
+	afree(playground->edges);
+	playground_grid_cleanup(&playground->edge_grid);
+	playground_grid_cleanup(&playground->body_grid);
+}
+
+// Sprite cache
+//
+// Decoded sprites are kept around after their tab moves on so switching
+// back is free. Entries in use by a tab are pinned, the rest are evicted
+// least recently used first once SPRITE_CACHE_BUDGET is exceeded.
+//
+// On native builds, files next to a loaded sprite are read and decoded on
+// the thread pool ahead of time. Only the final GPU upload happens on the
+// main thread, except for Aseprite files: CF can only build an animated
+// sprite from the file itself, so those are decoded again on the main
+// thread, at most one per frame.
+
+static bool
+is_sprite_path(const char* path) {
+	return str_ends_with(path, ".ase")
+		|| str_ends_with(path, ".aseprite")
+		|| str_ends_with(path, ".asperite")
+		|| str_ends_with(path, ".png");
+}
+
+static bool
+is_aseprite_path(const char* path) {
+	return str_ends_with(path, ".ase")
+		|| str_ends_with(path, ".aseprite")
+		|| str_ends_with(path, ".asperite");
+}
+
+static void
+unload_sprite(CF_Sprite* sprite) {
+	if (!sprite->name) { return; }
+
+	if (strcmp(sprite->name, "easy_sprite") == 0) {
+		cf_easy_sprite_unload(sprite);
+	} else {
+		cf_sprite_unload(sprite->name);
+	}
+}
+
+static sprite_cache_entry_t*
+sprite_cache_find(sprite_cache_t* cache, const char* path) {
+	for (int i = 0; i < alen(cache->entries); ++i) {
+		sprite_cache_entry_t* entry = cache->entries[i];
+		if (strcmp(entry->path, path) == 0) {
+			entry->last_used = ++cache->clock;
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+sprite_cache_trim(sprite_cache_t* cache) {
+	while (cache->total_size > SPRITE_CACHE_BUDGET) {
+		int victim = -1;
+		for (int i = 0; i < alen(cache->entries); ++i) {
+			sprite_cache_entry_t* entry = cache->entries[i];
+			if (
+				entry->ref_count == 0
+				&&
+				(victim < 0 || entry->last_used < cache->entries[victim]->last_used)
+			) {
+				victim = i;
+			}
+		}
+		if (victim < 0) { break; }
+
+		sprite_cache_entry_t* entry = cache->entries[victim];
+		cache->entries[victim] = cache->entries[alen(cache->entries) - 1];
+		apop(cache->entries);
+
+		cache->total_size -= entry->size;
+		unload_sprite(&entry->sprite);
+		cf_free(entry->mask);
+		cf_free(entry->path);
+		cf_free(entry);
+	}
+}
+
+// Every frame of an animation ends up in the atlas
+static size_t
+sprite_cache_entry_size(int width, int height, int num_frames, const uint64_t* mask) {
+	return (size_t)width * height * 4 * num_frames + (mask != NULL ? fit_mask_size(width, height) : 0);
+}
+
+// Takes ownership of the mask
+static sprite_cache_entry_t*
+sprite_cache_insert(
+	sprite_cache_t* cache,
+	const char* path,
+	CF_Sprite sprite,
+	uint64_t* mask,
+	int width, int height, int num_frames
+) {
+	sprite_cache_entry_t* entry = cf_alloc(sizeof(sprite_cache_entry_t));
+	*entry = (sprite_cache_entry_t){
+		.path = strclone(path),
+		.sprite = sprite,
+		.mask = mask,
+		.width = width,
+		.height = height,
+		.num_frames = num_frames,
+		.size = sprite_cache_entry_size(width, height, num_frames, mask),
+		.id = ++cache->clock,
+	};
+	entry->last_used = entry->id;
+	apush(cache->entries, entry);
+	cache->total_size += entry->size;
+
+	// Never evict what is being returned
+	++entry->ref_count;
+	sprite_cache_trim(cache);
+	--entry->ref_count;
+	return entry;
+}
+
+static sprite_cache_entry_t*
+sprite_cache_load(sprite_cache_t* cache, const char* path, const void* content, size_t size) {
+	if (is_aseprite_path(path)) {
+		CF_Sprite sprite = cf_make_sprite_from_memory(
+			path,
+			content, (int)size
+		);
+		if (!sprite.name) { return NULL; }
+
+		// The sprite does not expose its pixels, decode the first frame again
+		// for the alpha mask
+		uint64_t* mask = NULL;
+		int num_frames = 1;
+		ase_t* ase = cute_aseprite_load_from_memory(content, (int)size, NULL);
+		if (ase != NULL && ase->frame_count > 0) {
+			mask = fit_build_mask(ase->frames[0].pixels, ase->w, ase->h);
+			num_frames = ase->frame_count;
+		}
+		cute_aseprite_free(ase);
+
+		return sprite_cache_insert(cache, path, sprite, mask, sprite.w, sprite.h, num_frames);
+	} else if (str_ends_with(path, ".png")) {
+		sprite_cache_entry_t* entry = NULL;
+		CF_Image img;
+		CF_Result result = cf_image_load_png_from_memory(content, (int)size, &img);
+		if (!cf_is_error(result)) {
+			CF_Sprite sprite = cf_make_easy_sprite_from_pixels(img.pix, img.w, img.h);
+			if (sprite.name) {
+				uint64_t* mask = fit_build_mask(img.pix, img.w, img.h);
+				entry = sprite_cache_insert(cache, path, sprite, mask, img.w, img.h, 1);
+			}
+			cf_image_premultiply(&img);
+		}
+		cf_image_free(&img);
+		return entry;
+	} else {
+		return NULL;
+	}
+}
+
+static void
+sprite_cache_acquire(sprite_cache_t* cache, sprite_cache_entry_t* entry) {
+	++entry->ref_count;
+	entry->last_used = ++cache->clock;
+}
+
+static void
+sprite_cache_release(sprite_cache_t* cache, sprite_cache_entry_t* entry) {
+	--entry->ref_count;
+	sprite_cache_trim(cache);
+}
+
+#ifndef __EMSCRIPTEN__
+
+static int
+compare_strings(const void* lhs, const void* rhs) {
+	return strcmp(*(const char* const*)lhs, *(const char* const*)rhs);
+}
+
+// Sorted full paths of the sprites in the same folder as path
+static dyna char**
+list_sibling_sprites(const char* path) {
+	const char* basename = path_basename(path);
+	int dir_len = basename != path ? (int)(basename - path) - 1 : 1;
+	const char* dir = basename != path ? path : ".";
+	// A file at the root keeps its separator as the folder: "/a.png" is in "/"
+	if (dir_len == 0) { dir_len = 1; }
+	const char* separator = dir[dir_len - 1] == '/' || dir[dir_len - 1] == '\\' ? "" : "/";
+
+	dyna char** files = NULL;
+#ifdef _WIN32
+	if (*separator != '\0') { separator = "\\"; }
+	char* pattern = strprintf("%.*s%s*", dir_len, dir, separator);
+	struct _finddata_t data;
+	intptr_t handle = _findfirst(pattern, &data);
+	if (handle != -1) {
+		do {
+			if (!(data.attrib & _A_SUBDIR) && is_sprite_path(data.name)) {
+				apush(files, strprintf("%.*s%s%s", dir_len, dir, separator, data.name));
+			}
+		} while (_findnext(handle, &data) == 0);
+		_findclose(handle);
+	}
+	cf_free(pattern);
+#else
+	char* dir_path = strprintf("%.*s", dir_len, dir);
+	DIR* dir_handle = opendir(dir_path);
+	if (dir_handle != NULL) {
+		struct dirent* item;
+		while ((item = readdir(dir_handle)) != NULL) {
+			if (is_sprite_path(item->d_name)) {
+				apush(files, strprintf("%s%s%s", dir_path, separator, item->d_name));
+			}
+		}
+		closedir(dir_handle);
+	}
+	cf_free(dir_path);
+#endif
+
+	if (alen(files) > 1) {
+		qsort(files, alen(files), sizeof(files[0]), compare_strings);
+	}
+	return files;
+}
+
+static void
+free_string_list(dyna char** list) {
+	for (int i = 0; i < alen(list); ++i) {
+		cf_free(list[i]);
+	}
+	afree(list);
+}
+
+static int
+find_string(dyna char** list, const char* str) {
+	for (int i = 0; i < alen(list); ++i) {
+		if (strcmp(list[i], str) == 0) { return i; }
+	}
+
+	return -1;
+}
+
+struct sprite_prefetch_s {
+	sprite_cache_t* cache;
+	char* path;
+	uint64_t reload_serial;  // Non zero when replacing a loaded sprite
+	void* content;
+	size_t size;
+	CF_Image image;
+	bool has_image;
+	uint64_t* mask;
+	int width;
+	int height;
+	int num_frames;
+};
+
+// Runs on the thread pool, must not touch anything but the task itself
+static void
+sprite_prefetch_task(void* udata) {
+	sprite_prefetch_t* task = udata;
+	task->content = load_file_into_memory(task->path, &task->size);
+	if (task->content != NULL) {
+		if (is_aseprite_path(task->path)) {
+			ase_t* ase = cute_aseprite_load_from_memory(task->content, (int)task->size, NULL);
+			if (ase != NULL && ase->frame_count > 0) {
+				task->mask = fit_build_mask(ase->frames[0].pixels, ase->w, ase->h);
+				task->width = ase->w;
+				task->height = ase->h;
+				task->num_frames = ase->frame_count;
+			}
+			cute_aseprite_free(ase);
+		} else {
+			CF_Result result = cf_image_load_png_from_memory(task->content, (int)task->size, &task->image);
+			if (!cf_is_error(result)) {
+				task->has_image = true;
+				task->mask = fit_build_mask(task->image.pix, task->image.w, task->image.h);
+				task->width = task->image.w;
+				task->height = task->image.h;
+				task->num_frames = 1;
+			}
+			cf_free(task->content);
+			task->content = NULL;
+		}
+	}
+
+	sprite_cache_t* cache = task->cache;
+	cf_mutex_lock(&cache->lock);
+	apush(cache->prefetched, task);
+	cf_mutex_unlock(&cache->lock);
+}
+
+static void
+sprite_cache_prefetch_siblings(sprite_cache_t* cache, const char* path) {
+	dyna char** siblings = list_sibling_sprites(path);
+	int index = find_string(siblings, path);
+	if (index < 0) {
+		free_string_list(siblings);
+		return;
+	}
+
+	for (int offset = 1; offset <= SPRITE_PREFETCH_RADIUS; ++offset) {
+		for (int direction = -1; direction <= 1; direction += 2) {
+			int sibling = index + offset * direction;
+			if (sibling < 0 || sibling >= alen(siblings)) { continue; }
+
+			const char* sibling_path = siblings[sibling];
+			if (
+				sprite_cache_find(cache, sibling_path) != NULL
+				||
+				find_string(cache->in_flight, sibling_path) >= 0
+			) {
+				continue;
+			}
+
+			sprite_prefetch_t* task = cf_alloc(sizeof(sprite_prefetch_t));
+			*task = (sprite_prefetch_t){
+				.cache = cache,
+				.path = strclone(sibling_path),
+			};
+			apush(cache->in_flight, strclone(sibling_path));
+			cf_threadpool_add_task(cache->pool, sprite_prefetch_task, task);
+		}
+	}
+	cf_threadpool_kick(cache->pool);
+
+	free_string_list(siblings);
+}
+
+static void
+sprite_prefetch_free(sprite_prefetch_t* task) {
+	if (task->has_image) {
+		cf_image_free(&task->image);
+	}
+	cf_free(task->content);
+	cf_free(task->mask);
+	cf_free(task->path);
+	cf_free(task);
+}
+
+static CF_Sprite
+sprite_prefetch_make_sprite(sprite_prefetch_t* task) {
+	if (task->has_image) {
+		return cf_make_easy_sprite_from_pixels(task->image.pix, task->width, task->height);
+	} else if (task->content != NULL) {
+		return cf_make_sprite_from_memory(task->path, task->content, (int)task->size);
+	} else {
+		return cf_sprite_defaults();
+	}
+}
+
+// Takes the mask of the task
+static void
+sprite_cache_replace(sprite_cache_t* cache, sprite_cache_entry_t* entry, sprite_prefetch_t* task) {
+	// Aseprite sprites are cached by name inside CF, the old one must go first
+	unload_sprite(&entry->sprite);
+	entry->sprite = sprite_prefetch_make_sprite(task);
+
+	cf_free(entry->mask);
+	entry->mask = task->mask;
+	task->mask = NULL;
+	entry->width = task->width;
+	entry->height = task->height;
+	entry->num_frames = task->num_frames;
+
+	cache->total_size -= entry->size;
+	entry->size = sprite_cache_entry_size(entry->width, entry->height, entry->num_frames, entry->mask);
+	cache->total_size += entry->size;
+	entry->id = ++cache->clock;
+
+	sprite_cache_trim(cache);
+}
+
+// Decodes a changed file again and swaps it into its entry once done
+static void
+sprite_cache_reload(sprite_cache_t* cache, const char* path) {
+	sprite_cache_entry_t* entry = sprite_cache_find(cache, path);
+	if (entry == NULL) { return; }
+
+	sprite_prefetch_t* task = cf_alloc(sizeof(sprite_prefetch_t));
+	*task = (sprite_prefetch_t){
+		.cache = cache,
+		.path = strclone(path),
+		.reload_serial = ++entry->reload_serial,
+	};
+	cf_threadpool_add_task(cache->pool, sprite_prefetch_task, task);
+	cf_threadpool_kick(cache->pool);
+}
+
+#endif
+
+// Upload whatever the thread pool finished since the last frame
+static void
+sprite_cache_update(sprite_cache_t* cache) {
+#ifndef __EMSCRIPTEN__
+	cf_mutex_lock(&cache->lock);
+	dyna sprite_prefetch_t** prefetched = cache->prefetched;
+	cache->prefetched = NULL;
+	cf_mutex_unlock(&cache->lock);
+
+	dyna sprite_prefetch_t** deferred = NULL;
+	bool decoded_aseprite = false;
+	for (int i = 0; i < alen(prefetched); ++i) {
+		sprite_prefetch_t* task = prefetched[i];
+
+		// Only one Aseprite decode per frame, the rest wait their turn
+		bool is_aseprite = !task->has_image && task->content != NULL;
+		if (is_aseprite && decoded_aseprite) {
+			apush(deferred, task);
+			continue;
+		}
+		decoded_aseprite |= is_aseprite;
+
+		if (task->reload_serial != 0) {
+			// Only the latest reload counts, and a half written file keeps
+			// the old sprite around
+			sprite_cache_entry_t* entry = sprite_cache_find(cache, task->path);
+			bool decoded = task->has_image || task->mask != NULL;
+			if (entry != NULL && entry->reload_serial == task->reload_serial && decoded) {
+				sprite_cache_replace(cache, entry, task);
+			}
+		} else {
+			int in_flight = find_string(cache->in_flight, task->path);
+			if (in_flight >= 0) {
+				cf_free(cache->in_flight[in_flight]);
+				cache->in_flight[in_flight] = cache->in_flight[alen(cache->in_flight) - 1];
+				apop(cache->in_flight);
+			}
+
+			if (sprite_cache_find(cache, task->path) == NULL) {
+				CF_Sprite sprite = sprite_prefetch_make_sprite(task);
+				if (sprite.name) {
+					sprite_cache_insert(cache, task->path, sprite, task->mask, sprite.w, sprite.h, task->num_frames);
+					task->mask = NULL;
+				}
+			}
+		}
+
+		sprite_prefetch_free(task);
+	}
+	afree(prefetched);
+
+	if (alen(deferred) > 0) {
+		cf_mutex_lock(&cache->lock);
+		for (int i = 0; i < alen(deferred); ++i) {
+			apush(cache->prefetched, deferred[i]);
+		}
+		cf_mutex_unlock(&cache->lock);
+	}
+	afree(deferred);
+#endif
+}
+
+static void
+sprite_cache_init(sprite_cache_t* cache, CF_Threadpool* pool) {
+	*cache = (sprite_cache_t){ 0 };
+#ifndef __EMSCRIPTEN__
+	cache->pool = pool;
+	cache->lock = cf_make_mutex();
+#else
+	(void)pool;
+#endif
+}
+
+static void
+sprite_cache_cleanup(sprite_cache_t* cache) {
+#ifndef __EMSCRIPTEN__
+	cf_threadpool_kick_and_wait(cache->pool);
+	for (int i = 0; i < alen(cache->prefetched); ++i) {
+		sprite_prefetch_free(cache->prefetched[i]);
+	}
+	afree(cache->prefetched);
+	cf_destroy_mutex(&cache->lock);
+	free_string_list(cache->in_flight);
+#endif
+
+	for (int i = 0; i < alen(cache->entries); ++i) {
+		sprite_cache_entry_t* entry = cache->entries[i];
+		unload_sprite(&entry->sprite);
+		cf_free(entry->mask);
+		cf_free(entry->path);
+		cf_free(entry);
+	}
+	afree(cache->entries);
+}
+
+// Workspace
+
+static workspace_doc_t*
+workspace_add_doc(workspace_t* workspace) {
+	workspace_doc_t* tab = cf_alloc(sizeof(workspace_doc_t));
+	*tab = (workspace_doc_t){
+		.id = ++workspace->next_doc_id,
+		.history = cf_alloc(sizeof(shape_history_t)),
+		.sprite = workspace->demo_sprite,
+		.draw_scale = 1.f,
+	};
+	*tab->history = (shape_history_t){ 0 };
+	history_reset(tab->history);
+
+	apush(workspace->docs, tab);
+	workspace->active = alen(workspace->docs) - 1;
+	workspace->select_active = true;
+	workspace->journal_dirty = true;
+	return tab;
+}
+
+static workspace_doc_t*
+workspace_active_doc(workspace_t* workspace) {
+	return workspace->docs[workspace->active];
+}
+
+static int
+workspace_find_doc(workspace_t* workspace, const workspace_doc_t* tab) {
+	for (int i = 0; i < alen(workspace->docs); ++i) {
+		if (workspace->docs[i] == tab) { return i; }
+	}
+
+	return -1;
+}
+
+static int
+workspace_find_file(workspace_t* workspace, const char* path) {
+	for (int i = 0; i < alen(workspace->docs); ++i) {
+		const char* filename = workspace->docs[i]->doc.filename;
+		if (filename != NULL && strcmp(filename, path) == 0) { return i; }
+	}
+
+	return -1;
+}
+
+// An untitled document nobody has touched can be replaced when opening
+static bool
+workspace_doc_is_pristine(workspace_doc_t* tab) {
+	return tab->doc.filename == NULL
+		&& tab->history->current == tab->history->root
+		&& tab->history->root->first_child == NULL
+		&& current_shape(tab->history)->num_vertices == 0;
+}
+
+static void
+workspace_doc_set_sprite(workspace_t* workspace, workspace_doc_t* tab, sprite_cache_entry_t* entry) {
+	if (entry != NULL) {
+		sprite_cache_acquire(workspace->sprite_cache, entry);
+	}
+	if (tab->sprite_entry != NULL) {
+		sprite_cache_release(workspace->sprite_cache, tab->sprite_entry);
+	}
+
+	tab->sprite_entry = entry;
+	tab->sprite_id = entry != NULL ? entry->id : 0;
+	tab->sprite = entry != NULL ? entry->sprite : workspace->demo_sprite;
+	cf_free(tab->animation);
+	tab->animation = NULL;
+}
+
+static void
+workspace_doc_play(workspace_doc_t* tab, const char* animation) {
+	cf_sprite_play(&tab->sprite, animation);
+	cf_free(tab->animation);
+	tab->animation = strclone(animation);
+}
+
+// Hash of every open shape, for comparing replays
+static uint64_t
+workspace_hash_shapes(workspace_t* workspace) {
+	uint64_t hash = HASH_SEED;
+	for (int i = 0; i < alen(workspace->docs); ++i) {
+		const shape_t* shape = current_shape(workspace->docs[i]->history);
+		hash = hash_bytes(hash, &shape->num_vertices, sizeof(shape->num_vertices));
+		hash = hash_bytes(hash, shape->verts, sizeof(CF_V2) * shape->num_vertices);
+	}
+	return hash;
+}
+
+// Picks up sprites that were reloaded from disk
+static void
+workspace_refresh_sprites(workspace_t* workspace) {
+	for (int i = 0; i < alen(workspace->docs); ++i) {
+		workspace_doc_t* tab = workspace->docs[i];
+		sprite_cache_entry_t* entry = tab->sprite_entry;
+		if (entry == NULL || tab->sprite_id == entry->id) { continue; }
+
+		tab->sprite = entry->sprite;
+		tab->sprite_id = entry->id;
+		for (int j = 0; tab->animation != NULL && j < hsize(tab->sprite.animations); ++j) {
+			if (strcmp(tab->sprite.animations[j]->name, tab->animation) == 0) {
+				cf_sprite_play(&tab->sprite, tab->animation);
+				break;
+			}
+		}
+	}
+}
+
+static void
+workspace_free_doc(workspace_t* workspace, workspace_doc_t* tab) {
+	workspace_doc_set_sprite(workspace, tab, NULL);
+	history_cleanup(tab->history);
+	cf_free(tab->history);
+	cf_free(tab->doc.filename);
+	cf_free(tab->doc.name);
+	cf_free(tab);
+}
+
+// There is always at least one document open
+static void
+workspace_close_doc(workspace_t* workspace, int index) {
+	workspace_free_doc(workspace, workspace->docs[index]);
+	for (int i = index + 1; i < alen(workspace->docs); ++i) {
+		workspace->docs[i - 1] = workspace->docs[i];
+	}
+	apop(workspace->docs);
+
+	if (alen(workspace->docs) == 0) {
+		workspace_add_doc(workspace);
+	} else if (workspace->active >= index && workspace->active > 0) {
+		--workspace->active;
+	}
+	workspace->select_active = true;
+	workspace->journal_dirty = true;
+}
+
+static void
+workspace_cleanup(workspace_t* workspace) {
+	for (int i = 0; i < alen(workspace->docs); ++i) {
+		workspace_free_doc(workspace, workspace->docs[i]);
+	}
+	afree(workspace->docs);
+}
+
+// Returns the document to close, if any
+static workspace_doc_t*
+workspace_tab_bar(workspace_t* workspace, float y) {
+	workspace_doc_t* close_target = NULL;
+
+	ImGuiViewport* viewport = ImGui_GetMainViewport();
+	ImGui_SetNextWindowPos((ImVec2){ viewport->WorkPos.x, y }, ImGuiCond_Always);
+	ImGui_SetNextWindowSize((ImVec2){ viewport->WorkSize.x, 0.f }, ImGuiCond_Always);
+	ImGuiWindowFlags flags = ImGuiWindowFlags_NoDecoration
+		| ImGuiWindowFlags_NoMove
+		| ImGuiWindowFlags_NoSavedSettings
+		| ImGuiWindowFlags_NoBringToFrontOnFocus
+		| ImGuiWindowFlags_AlwaysAutoResize;
+	if (ImGui_Begin("Documents", NULL, flags)) {
+		if (ImGui_BeginTabBar("Documents", ImGuiTabBarFlags_Reorderable | ImGuiTabBarFlags_FittingPolicyScroll)) {
+			for (int i = 0; i < alen(workspace->docs); ++i) {
+				workspace_doc_t* tab = workspace->docs[i];
+				const char* title = tab->doc.filename != NULL
+					? path_basename(tab->doc.filename)
+					: (tab->doc.name != NULL ? tab->doc.name : "untitled");
+
+				ImGuiTabItemFlags tab_flags = ImGuiTabItemFlags_None;
+				if (tab->doc.saved_version != current_shape_version(tab->history)) {
+					tab_flags |= ImGuiTabItemFlags_UnsavedDocument;
+				}
+				if (workspace->select_active && i == workspace->active) {
+					tab_flags |= ImGuiTabItemFlags_SetSelected;
+				}
+
+				bool open = true;
+				ImGui_PushIDPtr(tab);
+				if (ImGui_BeginTabItem(title, &open, tab_flags)) {
+					if (!workspace->select_active) {
+						workspace->active = i;
+					}
+					ImGui_EndTabItem();
+				}
+				ImGui_PopID();
+
+				if (!open) {
+					close_target = tab;
+				}
+			}
+			ImGui_EndTabBar();
+		}
+	}
+	ImGui_End();
+	workspace->select_active = false;
+
+	return close_target;
+}
+
+#ifndef __EMSCRIPTEN__
+
+// File watching
+//
+// inotify watches the parent folder rather than the file itself, since
+// exporters tend to write a temporary file and rename it over the old one.
+// Anything inotify can't watch is polled with stat() instead. Changes are
+// only reported once writes to a file have been quiet for WATCH_DEBOUNCE.
+
+static bool
+file_stamp(const char* path, int64_t* mtime, int64_t* size) {
+#ifdef _WIN32
+	struct _stat info;
+	if (_stat(path, &info) != 0) { return false; }
+#else
+	struct stat info;
+	if (stat(path, &info) != 0) { return false; }
+#endif
+
+	*mtime = (int64_t)info.st_mtime;
+	*size = (int64_t)info.st_size;
+	return true;
+}
+
+static void
+file_watcher_init(file_watcher_t* watcher) {
+	*watcher = (file_watcher_t){ .inotify_fd = -1 };
+#ifdef __linux__
+	watcher->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+}
+
+static void
+file_watcher_add(file_watcher_t* watcher, const char* path) {
+	watched_file_t file = {
+		.path = strclone(path),
+		.wd = -1,
+		.wanted = true,
+	};
+	file_stamp(path, &file.mtime, &file.size);
+
+#ifdef __linux__
+	if (watcher->inotify_fd >= 0) {
+		const char* basename = path_basename(path);
+		char* dir = basename != path
+			? strprintf("%.*s", (int)(basename - path), path)
+			: strclone(".");
+		file.wd = inotify_add_watch(
+			watcher->inotify_fd,
+			dir,
+			IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE
+		);
+		cf_free(dir);
+	}
+#endif
+
+	apush(watcher->files, file);
+}
+
+static void
+file_watcher_remove(file_watcher_t* watcher, int index) {
+	watched_file_t* file = &watcher->files[index];
+
+#ifdef __linux__
+	// Folders are shared between files
+	bool shared = false;
+	for (int i = 0; i < alen(watcher->files); ++i) {
+		shared |= i != index && watcher->files[i].wd == file->wd;
+	}
+	if (file->wd >= 0 && !shared) {
+		inotify_rm_watch(watcher->inotify_fd, file->wd);
+	}
+#endif
+
+	cf_free(file->path);
+	*file = watcher->files[alen(watcher->files) - 1];
+	apop(watcher->files);
+}
+
+static void
+file_watcher_want(file_watcher_t* watcher, const char* path) {
+	for (int i = 0; i < alen(watcher->files); ++i) {
+		if (strcmp(watcher->files[i].path, path) == 0) {
+			watcher->files[i].wanted = true;
+			return;
+		}
+	}
+
+	file_watcher_add(watcher, path);
+}
+
+// Watches the open documents and every cached sprite, so a sprite picked
+// from the cache later is not stale either
+static void
+file_watcher_sync(file_watcher_t* watcher, workspace_t* workspace) {
+	for (int i = 0; i < alen(watcher->files); ++i) {
+		watcher->files[i].wanted = false;
+	}
+
+	for (int i = 0; i < alen(workspace->docs); ++i) {
+		const char* filename = workspace->docs[i]->doc.filename;
+		if (filename != NULL) {
+			file_watcher_want(watcher, filename);
+		}
+	}
+
+	sprite_cache_t* cache = workspace->sprite_cache;
+	for (int i = 0; i < alen(cache->entries); ++i) {
+		file_watcher_want(watcher, cache->entries[i]->path);
+	}
+
+	for (int i = alen(watcher->files) - 1; i >= 0; --i) {
+		if (!watcher->files[i].wanted) {
+			file_watcher_remove(watcher, i);
+		}
+	}
+}
+
+static void
+file_watcher_touch(watched_file_t* file) {
+	file->pending = true;
+	file->debounce = WATCH_DEBOUNCE;
+}
+
+static void
+file_watcher_read_events(file_watcher_t* watcher) {
+#ifdef __linux__
+	if (watcher->inotify_fd < 0) { return; }
+
+	_Alignas(struct inotify_event) char buf[4096];
+	ssize_t len;
+	while ((len = read(watcher->inotify_fd, buf, sizeof(buf))) > 0) {
+		for (char* itr = buf; itr < buf + len;) {
+			const struct inotify_event* event = (const struct inotify_event*)itr;
+			itr += sizeof(struct inotify_event) + event->len;
+
+			for (int i = 0; i < alen(watcher->files); ++i) {
+				watched_file_t* file = &watcher->files[i];
+				if (event->mask & IN_Q_OVERFLOW) {
+					file_watcher_touch(file);
+				} else if (
+					file->wd == event->wd
+					&&
+					event->len > 0
+					&&
+					strcmp(path_basename(file->path), event->name) == 0
+				) {
+					file_watcher_touch(file);
+				}
+			}
+		}
+	}
+#endif
+}
+
+static void
+file_watcher_poll(file_watcher_t* watcher, float dt) {
+	watcher->time_since_poll += dt;
+	if (watcher->time_since_poll < WATCH_POLL_INTERVAL) { return; }
+	watcher->time_since_poll = 0.f;
+
+	for (int i = 0; i < alen(watcher->files); ++i) {
+		watched_file_t* file = &watcher->files[i];
+		if (file->wd >= 0) { continue; }
+
+		int64_t mtime, size;
+		if (
+			file_stamp(file->path, &mtime, &size)
+			&&
+			(mtime != file->mtime || size != file->size)
+		) {
+			file->mtime = mtime;
+			file->size = size;
+			file_watcher_touch(file);
+		}
+	}
+}
+
+static void
+file_watcher_update(file_watcher_t* watcher, float dt) {
+	aclear(watcher->changed);
+
+	file_watcher_read_events(watcher);
+	file_watcher_poll(watcher, dt);
+
+	for (int i = 0; i < alen(watcher->files); ++i) {
+		watched_file_t* file = &watcher->files[i];
+		if (!file->pending) { continue; }
+
+		file->debounce -= dt;
+		if (file->debounce <= 0.f) {
+			file->pending = false;
+			apush(watcher->changed, file->path);
+		}
+	}
+}
+
+static void
+file_watcher_cleanup(file_watcher_t* watcher) {
+	for (int i = 0; i < alen(watcher->files); ++i) {
+		cf_free(watcher->files[i].path);
+	}
+	afree(watcher->files);
+	afree(watcher->changed);
+
+#ifdef __linux__
+	if (watcher->inotify_fd >= 0) {
+		close(watcher->inotify_fd);
+	}
+#endif
+}
+
+#endif
+
+// Edit journal
+//
+// Every edit is appended as a small record so that a crash loses at most
+// JOURNAL_FLUSH_INTERVAL worth of work. Saving, loading or starting a new
+// document truncates the journal down to a single BEGIN record holding the
+// full shape. A torn record at the end is ignored during replay.
+//
+// Only the active tab is edited, so it is the only one with a record per
+// edit. Every other tab with unsaved changes is stored in full ahead of it
+// and stays valid until something marks workspace_t.journal_dirty, which
+// starts the journal over.
+
+static void
+journal_put(journal_t* journal, const void* data, size_t size) {
+	const uint8_t* bytes = data;
+	for (size_t i = 0; i < size; ++i) {
+		apush(journal->pending, bytes[i]);
+	}
+}
+
+static void
+journal_start_record(journal_t* journal, journal_op_t op) {
+	journal->last_record = alen(journal->pending);
+	uint8_t tag = (uint8_t)op;
+	journal_put(journal, &tag, sizeof(tag));
+}
+
+static void
+journal_put_string(journal_t* journal, const char* str) {
+	uint32_t len = str != NULL ? (uint32_t)strlen(str) : 0;
+	journal_put(journal, &len, sizeof(len));
+	journal_put(journal, str, len);
+}
+
+static void
+journal_put_document(journal_t* journal, journal_op_t op, const document_t* doc, const shape_t* shape, bool saved) {
+	journal_start_record(journal, op);
+	uint8_t saved_flag = saved;
+	journal_put(journal, &saved_flag, sizeof(saved_flag));
+	journal_put_string(journal, doc->filename);
+	journal_put_string(journal, doc->name);
+	uint32_t num_vertices = (uint32_t)shape->num_vertices;
+	journal_put(journal, &num_vertices, sizeof(num_vertices));
+	journal_put(journal, shape->verts, num_vertices * sizeof(shape->verts[0]));
+}
+
+static void
+journal_put_begin(journal_t* journal, const document_t* doc, const shape_t* shape, bool saved) {
+	journal_put_document(journal, JOURNAL_OP_BEGIN, doc, shape, saved);
+	journal->num_undoable = 0;
+	journal->num_redoable = 0;
+}
+
+static void
+journal_put_vertex(journal_t* journal, journal_op_t op, int index, CF_V2 vert) {
+	int32_t index32 = index;
+	journal_start_record(journal, op);
+	journal_put(journal, &index32, sizeof(index32));
+	journal_put(journal, &vert, sizeof(vert));
+}
+
+static void
+journal_flush(journal_t* journal) {
+	journal->time_since_flush = 0.f;
+	if (!journal->open || alen(journal->pending) == 0) { return; }
+
+	// One write and one sync for the whole batch
+#ifndef __EMSCRIPTEN__
+	if (journal->file != NULL) {
+		size_t size = (size_t)alen(journal->pending);
+		if (fwrite(journal->pending, 1, size, journal->file) != size || !sync_file(journal->file)) {
+			fclose(journal->file);
+			journal->file = NULL;
+			journal->failed = true;
+			journal->time_since_failure = 0.f;
+		}
+	}
+#else
+	web_journal_append(journal->pending, (size_t)alen(journal->pending), false);
+#endif
+
+	aclear(journal->pending);
+	journal->last_record = -1;
+}
+
+// A journal that is not persistent keeps all its bookkeeping but never
+// writes anything out.
+//
+// Every running instance locks a slot of its own: journal.bin, then
+// journal-1.bin and so on. A crashed instance leaves its slot unlocked, so
+// the next launch to take it recovers what was in it.
+static void
+journal_init(journal_t* journal, bool persistent) {
+	*journal = (journal_t){ .last_record = -1 };
+#ifndef __EMSCRIPTEN__
+	journal->lock_fd = -1;
+	const char* dir = persistent ? cf_fs_get_user_directory("bullno1", "cute-shaper") : NULL;
+	if (dir != NULL) {
+		size_t len = strlen(dir);
+		const char* separator = len > 0 && (dir[len - 1] == '/' || dir[len - 1] == '\\') ? "" : "/";
+		for (int slot = 0; slot < JOURNAL_MAX_SLOTS && journal->path == NULL; ++slot) {
+			char* name = slot == 0 ? strprintf("journal") : strprintf("journal-%d", slot);
+			char* lock_path = strprintf("%s%s%s.lock", dir, separator, name);
+			journal->lock_fd = lock_file(lock_path);
+			if (journal->lock_fd >= 0) {
+				journal->path = strprintf("%s%s%s.bin", dir, separator, name);
+			}
+			cf_free(lock_path);
+			cf_free(name);
+		}
+		journal->failed = journal->path == NULL;
+	}
+#endif
+}
+
+static void*
+journal_load(journal_t* journal, size_t* size) {
+#ifndef __EMSCRIPTEN__
+	if (journal->path == NULL) { return NULL; }
+	return load_file_into_memory(journal->path, size);
+#else
+	void* content = NULL;
+	return web_journal_load(&content, size) ? content : NULL;
+#endif
+}
+
+static void
+journal_free_content(void* content) {
+#ifndef __EMSCRIPTEN__
+	cf_free(content);
+#else
+	free(content);
+#endif
+}
+
+// Start over from the current tabs, discarding everything recorded so far
+static void
+journal_begin(journal_t* journal, workspace_t* workspace) {
+	aclear(journal->pending);
+	journal_put(journal, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC) - 1);
+	for (int i = 0; i < alen(workspace->docs); ++i) {
+		workspace_doc_t* tab = workspace->docs[i];
+		if (i != workspace->active && tab->doc.saved_version != current_shape_version(tab->history)) {
+			journal_put_document(journal, JOURNAL_OP_BACKGROUND, &tab->doc, current_shape(tab->history), false);
+		}
+	}
+	workspace_doc_t* active = workspace_active_doc(workspace);
+	journal_put_begin(
+		journal,
+		&active->doc,
+		current_shape(active->history),
+		active->doc.saved_version == current_shape_version(active->history)
+	);
+	workspace->journal_dirty = false;
+
+#ifndef __EMSCRIPTEN__
+	if (journal->file != NULL) {
+		fclose(journal->file);
+	}
+	journal->file = NULL;
+	if (journal->path != NULL) {
+		journal->file = fopen(journal->path, "wb");
+		journal->failed = journal->file == NULL;
+		journal->time_since_failure = 0.f;
+	}
+	journal->open = true;
+	journal_flush(journal);
+#else
+	web_journal_append(journal->pending, (size_t)alen(journal->pending), true);
+	aclear(journal->pending);
+	journal->open = true;
+	journal->time_since_flush = 0.f;
+#endif
+	journal->last_record = -1;
+}
+
+static void
+journal_commit(journal_t* journal) {
+	if (!journal->open) { return; }
+
+	journal_start_record(journal, JOURNAL_OP_COMMIT);
+	++journal->num_undoable;
+	journal->num_redoable = 0;
+}
+
+static void
+journal_insert(journal_t* journal, int index, CF_V2 vert) {
+	if (!journal->open) { return; }
+
+	journal_put_vertex(journal, JOURNAL_OP_INSERT, index, vert);
+}
+
+static void
+journal_remove(journal_t* journal, int index) {
+	if (!journal->open) { return; }
+
+	int32_t index32 = index;
+	journal_start_record(journal, JOURNAL_OP_REMOVE);
+	journal_put(journal, &index32, sizeof(index32));
+}
+
+static void
+journal_set(journal_t* journal, int index, CF_V2 vert) {
+	if (!journal->open) { return; }
+
+	// Coalesce repeated moves of the same vertex into one record
+	if (
+		journal->last_record >= 0
+		&&
+		journal->pending[journal->last_record] == JOURNAL_OP_SET
+	) {
+		int32_t last_index;
+		memcpy(&last_index, &journal->pending[journal->last_record + 1], sizeof(last_index));
+		if (last_index == index) {
+			memcpy(&journal->pending[journal->last_record + 1 + sizeof(last_index)], &vert, sizeof(vert));
+			return;
+		}
+	}
+
+	journal_put_vertex(journal, JOURNAL_OP_SET, index, vert);
+}
+
+static void
+journal_jump(journal_t* journal, const document_t* doc, const shape_t* shape, bool saved) {
+	if (!journal->open) { return; }
+
+	journal_put_begin(journal, doc, shape, saved);
+}
+
+// Undo and redo can step outside of what the journal has seen since the
+// last BEGIN. In that case the resulting shape is recorded in full.
+static void
+journal_undo(journal_t* journal, const document_t* doc, const shape_t* shape, bool saved) {
+	if (!journal->open) { return; }
+
+	if (journal->num_undoable > 0) {
+		journal_start_record(journal, JOURNAL_OP_UNDO);
+		--journal->num_undoable;
+		++journal->num_redoable;
+	} else {
+		journal_put_begin(journal, doc, shape, saved);
+	}
+}
+
+static void
+journal_redo(journal_t* journal, const document_t* doc, const shape_t* shape, bool saved) {
+	if (!journal->open) { return; }
+
+	if (journal->num_redoable > 0) {
+		journal_start_record(journal, JOURNAL_OP_REDO);
+		--journal->num_redoable;
+		++journal->num_undoable;
+	} else {
+		journal_put_begin(journal, doc, shape, saved);
+	}
+}
+
+// Returns whether the journal should start over to retry a failed write
+static bool
+journal_update(journal_t* journal, float dt) {
+	journal->time_since_flush += dt;
+	if (journal->time_since_flush >= JOURNAL_FLUSH_INTERVAL) {
+		journal_flush(journal);
+	}
+
+#ifndef __EMSCRIPTEN__
+	if (journal->failed && journal->path != NULL) {
+		journal->time_since_failure += dt;
+		return journal->time_since_failure >= JOURNAL_RETRY_INTERVAL;
+	}
+#endif
+	return false;
+}
+
+static void
+journal_cleanup(journal_t* journal) {
+	journal_flush(journal);
+#ifndef __EMSCRIPTEN__
+	if (journal->file != NULL) {
+		fclose(journal->file);
+	}
+	if (journal->lock_fd >= 0) {
+		unlock_file(journal->lock_fd);
+	}
+	cf_free(journal->path);
+#endif
+	afree(journal->pending);
+}
+
+typedef struct {
+	const uint8_t* cur;
+	const uint8_t* end;
+} journal_reader_t;
+
+static bool
+journal_read(journal_reader_t* reader, void* out, size_t size) {
+	if ((size_t)(reader->end - reader->cur) < size) { return false; }
+
+	memcpy(out, reader->cur, size);
+	reader->cur += size;
+	return true;
+}
+
+static bool
+journal_read_header(journal_reader_t* reader, const void* content, size_t size) {
+	reader->cur = content;
+	reader->end = reader->cur + size;
+
+	char magic[sizeof(JOURNAL_MAGIC) - 1];
+	return journal_read(reader, magic, sizeof(magic))
+		&& memcmp(magic, JOURNAL_MAGIC, sizeof(magic)) == 0;
+}
+
+typedef struct {
+	const char* str;  // Not terminated
+	uint32_t len;
+} journal_string_t;
+
+typedef struct {
+	bool saved;
+	journal_string_t filename;
+	journal_string_t name;
+	const void* verts;  // May be unaligned, copy out with memcpy
+	uint32_t num_vertices;
+} journal_begin_record_t;
+
+static bool
+journal_read_string(journal_reader_t* reader, journal_string_t* str) {
+	if (
+		!journal_read(reader, &str->len, sizeof(str->len))
+		||
+		(size_t)(reader->end - reader->cur) < str->len
+	) {
+		return false;
+	}
+	str->str = (const char*)reader->cur;
+	reader->cur += str->len;
+	return true;
+}
+
+static bool
+journal_read_begin(journal_reader_t* reader, journal_begin_record_t* record) {
+	uint8_t saved;
+	if (
+		!journal_read(reader, &saved, sizeof(saved))
+		||
+		!journal_read_string(reader, &record->filename)
+		||
+		!journal_read_string(reader, &record->name)
+	) {
+		return false;
+	}
+	record->saved = saved;
+
+	if (
+		!journal_read(reader, &record->num_vertices, sizeof(record->num_vertices))
+		||
+		record->num_vertices > MAX_NUM_VERTICES
+		||
+		(size_t)(reader->end - reader->cur) < record->num_vertices * sizeof(CF_V2)
+	) {
+		return false;
+	}
+	record->verts = reader->cur;
+	reader->cur += record->num_vertices * sizeof(CF_V2);
+
+	return true;
+}
+
+// A journal is worth recovering if it holds background documents, if its
+// base was never saved or if anything happened after it
+static bool
+journal_has_edits(const void* content, size_t size) {
+	journal_reader_t reader;
+	uint8_t op;
+	journal_begin_record_t begin;
+	if (
+		!journal_read_header(&reader, content, size)
+		||
+		!journal_read(&reader, &op, sizeof(op))
+		||
+		(op != JOURNAL_OP_BEGIN && op != JOURNAL_OP_BACKGROUND)
+		||
+		!journal_read_begin(&reader, &begin)
+	) {
+		return false;
+	}
+
+	return op == JOURNAL_OP_BACKGROUND || !begin.saved || reader.cur < reader.end;
+}
+
+// NULL for an empty string
+static char*
+journal_clone_string(const journal_string_t* str) {
+	if (str->len == 0) { return NULL; }
+
+	char* result = cf_alloc(str->len + 1);
+	memcpy(result, str->str, str->len);
+	result[str->len] = '\0';
+	return result;
+}
+
+static void
+journal_restore_document(const journal_begin_record_t* record, document_t* doc, shape_history_t* history) {
+	cf_free(doc->filename);
+	doc->filename = journal_clone_string(&record->filename);
+	cf_free(doc->name);
+	doc->name = journal_clone_string(&record->name);
+	doc->saved_version = record->saved ? 0 : UINT64_MAX;
+
+	history_reset(history);
+	shape_t* shape = current_shape(history);
+	shape->num_vertices = (int)record->num_vertices;
+	memcpy(shape->verts, record->verts, record->num_vertices * sizeof(CF_V2));
+}
+
+// Returns whether the active document could be reconstructed into tab.
+// Background documents come back as new tabs.
+static bool
+journal_replay(const void* content, size_t size, workspace_t* workspace, workspace_doc_t* tab) {
+	journal_reader_t reader;
+	if (!journal_read_header(&reader, content, size)) { return false; }
+
+	document_t* doc = &tab->doc;
+	shape_history_t* history = tab->history;
+
+	bool has_base = false;
+	uint8_t op;
+	while (journal_read(&reader, &op, sizeof(op))) {
+		int32_t index;
+		CF_V2 vert;
+		bool complete = true;
+		switch ((journal_op_t)op) {
+			case JOURNAL_OP_BEGIN: {
+				journal_begin_record_t begin;
+				complete = journal_read_begin(&reader, &begin);
+				if (!complete) { break; }
+
+				journal_restore_document(&begin, doc, history);
+				has_base = true;
+			} break;
+			case JOURNAL_OP_BACKGROUND: {
+				journal_begin_record_t background;
+				complete = !has_base && journal_read_begin(&reader, &background);
+				if (!complete) { break; }
+
+				workspace_doc_t* background_tab = workspace_add_doc(workspace);
+				journal_restore_document(&background, &background_tab->doc, background_tab->history);
+			} break;
+			case JOURNAL_OP_COMMIT:
+				commit_shape(history);
+				break;
+			case JOURNAL_OP_INSERT:
+				complete = journal_read(&reader, &index, sizeof(index))
+					&& journal_read(&reader, &vert, sizeof(vert));
+				if (complete) {
+					shape_insert_vertex(current_shape(history), index, vert);
+				}
+				break;
+			case JOURNAL_OP_REMOVE:
+				complete = journal_read(&reader, &index, sizeof(index));
+				if (complete) {
+					shape_remove_vertex(current_shape(history), index);
+				}
+				break;
+			case JOURNAL_OP_SET:
+				complete = journal_read(&reader, &index, sizeof(index))
+					&& journal_read(&reader, &vert, sizeof(vert));
+				if (complete) {
+					shape_t* shape = current_shape(history);
+					if (index >= 0 && index < shape->num_vertices) {
+						shape->verts[index] = vert;
+					}
+				}
+				break;
+			case JOURNAL_OP_UNDO:
+				history_undo(history);
+				break;
+			case JOURNAL_OP_REDO:
+				history_redo(history);
+				break;
+			default:
+				complete = false;
+				break;
+		}
+
+		if (!complete || (!has_base && op != JOURNAL_OP_BACKGROUND)) { break; }
+	}
+
+	int index = workspace_find_doc(workspace, tab);
+	if (index >= 0) {
+		workspace->active = index;
+		workspace->select_active = true;
+	}
+	return has_base;
+}
+
+static char* title_buf = NULL;
+static void
+set_title(const document_t* doc, uint64_t current_version) {
+	const char* title = doc->filename;
+	if (title == NULL) { title = doc->name; }
+	if (title == NULL) { title = "untitled"; }
+
+	if (doc->saved_version != current_version) {
+		int size = snprintf(NULL, 0, "%s *", title);
+		title_buf = cf_realloc(title_buf, size + 1);
+		snprintf(title_buf, size + 1, "%s *", title);
+		cf_app_set_title(title_buf);
+	} else {
+		cf_app_set_title(title);
+	}
+}
+
+static void
+show_text_popup(text_popup_t* popup, const char* message) {
+	popup->message = message;
+	ImGui_OpenPopupID(popup->id, ImGuiPopupFlags_None);
+}
+
+static save_result_t
+pick_save_target(text_popup_t* text_popup, document_t* doc) {
+#ifndef __EMSCRIPTEN__
+	nfdu8char_t* path = NULL;
+	nfdu8filteritem_t filters[] = {
+		{
+			.name = "JSON",
+			.spec = "json",
+		}
+	};
+	nfdresult_t save_result = NFD_SaveDialogU8(
+		&path,
+		filters, sizeof(filters) / sizeof(filters[0]),
+		NULL,
+		NULL
+	);
+
+	if (save_result == NFD_OKAY) {
+		cf_free(doc->filename);
+		if (str_ends_with(path, ".json")) {
+			doc->filename = strclone(path);
+		} else {
+			doc->filename = strprintf("%s.json", path);
+		}
+
+		NFD_FreePathU8(path);
+		return SAVE_OK;
+	} else if (save_result == NFD_ERROR) {
+		show_text_popup(text_popup, NFD_GetError());
+		return SAVE_ERROR;
+	} else {
+		return SAVE_CANCELLED;
+	}
+#else
+	// The browser asks where to save when there is no file yet
+	doc->save_handle = 0;
+	return SAVE_OK;
+#endif
+}
+
+typedef struct {
+	text_popup_t* text_popup;
+	workspace_t* workspace;
+	workspace_doc_t* tab;
+	document_t* doc;
+	shape_history_t* history;
+	journal_t* journal;
+	import_t* import;
+} doc_modal_ctx_t;
+
+static save_result_t
+do_save_doc(CF_Coroutine coro, doc_modal_ctx_t* ctx) {
+	CF_JDoc jdoc = cf_make_json(NULL, 0);
+	CF_JVal root = cf_json_object(jdoc);
+	cf_json_set_root(jdoc, root);
+
+	cf_json_object_add_string(jdoc, root, "type", "polygon");
+
+	CF_JVal verts = cf_json_array(jdoc);
+	cf_json_object_add(jdoc, root, "vertices", verts);
+
+	shape_t* shape = current_shape(ctx->history);
+	for (int i = 0; i < shape->num_vertices; ++i) {
+		float data[] = { shape->verts[i].x, shape->verts[i].y };
+		CF_JVal vert = cf_json_array_from_float(
+			jdoc, data, sizeof(data) / sizeof(data[0])
+		);
+		cf_json_array_add(verts, vert);
+	}
+
+	dyna char* content = cf_json_to_string(jdoc);
+#ifndef __EMSCRIPTEN__
+	(void)coro;
+	save_result_t save_result = save_into_file(ctx->doc->filename, content, slen(content))
+		? SAVE_OK
+		: SAVE_ERROR;
+#else
+	save_result_t save_result = web_save_file(coro, ctx->doc, content, slen(content));
+#endif
+	if (save_result == SAVE_OK) {
+		ctx->doc->disk_hash = hash_bytes(HASH_SEED, content, slen(content));
+	} else if (save_result == SAVE_ERROR) {
+		show_text_popup(ctx->text_popup, "Could not save file");
+	}
+	sfree(content);
+
+	cf_destroy_json(jdoc);
+
+	if (save_result == SAVE_OK) {
+		ctx->doc->saved_version = current_shape_version(ctx->history);
+		ctx->workspace->journal_dirty = true;
+	}
+
+	return save_result;
+}
+
+static save_result_t
+save_doc_as(CF_Coroutine coro, doc_modal_ctx_t* ctx) {
+	save_result_t save_result;
+	if ((save_result = pick_save_target(ctx->text_popup, ctx->doc)) == SAVE_OK) {
+		return do_save_doc(coro, ctx);
+	} else {
+		return save_result;
+	}
+}
+
+static save_result_t
+save_doc(CF_Coroutine coro, doc_modal_ctx_t* ctx) {
+	if (ctx->doc->filename == NULL) {
+		return save_doc_as(coro, ctx);
+	} else {
+		return do_save_doc(coro, ctx);
+	}
+}
+
+// Modals since the browser only reports back on a later frame
+static void
+save_doc_modal(CF_Coroutine coro) {
+	doc_modal_ctx_t ctx = *(doc_modal_ctx_t*)cf_coroutine_get_udata(coro);
+	save_doc(coro, &ctx);
+}
+
+static void
+save_doc_as_modal(CF_Coroutine coro) {
+	doc_modal_ctx_t ctx = *(doc_modal_ctx_t*)cf_coroutine_get_udata(coro);
+	save_doc_as(coro, &ctx);
+}
+
+typedef enum {
+	MODAL_CHOICE_NONE,
+	MODAL_CHOICE_YES,
+	MODAL_CHOICE_NO,
+	MODAL_CHOICE_CANCEL,
+} modal_choice_t;
+
+static modal_choice_t
+modal_confirm(CF_Coroutine coro, const char* message, bool may_cancel) {
+	ImGui_OpenPopup("Confirmation", ImGuiPopupFlags_AnyPopup);
+
+	modal_choice_t choice = MODAL_CHOICE_NONE;
+	while (choice == MODAL_CHOICE_NONE) {
+		if (ImGui_BeginPopupModal("Confirmation", NULL, ImGuiWindowFlags_AlwaysAutoResize)) {
+			ImGui_Text("%s", message);
+			if (ImGui_Button("Yes")) {
+				choice = MODAL_CHOICE_YES;
+			}
+
+			if (ImGui_Button("No")) {
+				choice = MODAL_CHOICE_NO;
+			}
+
+			if (may_cancel && ImGui_Button("Cancel")) {
+				choice = MODAL_CHOICE_CANCEL;
+			}
+
+			ImGui_EndPopup();
+		}
+		cf_coroutine_yield(coro);
+	}
+
+	return choice;
+}
+
+static bool
+should_continue_after_saving_current_doc(
+	CF_Coroutine coro,
+	doc_modal_ctx_t* ctx
+) {
+	if (ctx->doc->saved_version == current_shape_version(ctx->history)) {
+		return true;
+	}
+
+	modal_choice_t choice = modal_confirm(
+		coro,
+		"There are unsaved changes.\n\n"
+		"Do you want to save first?",
+		true
+	);
+
+	if (choice == MODAL_CHOICE_YES) {
+		save_result_t save_result = save_doc(coro, ctx);
+		if (save_result == SAVE_CANCELLED) {
+			return false;
+		} else if (save_result == SAVE_ERROR) {
+			return modal_confirm(
+				coro,
+				"Could not save changes.\n\n"
+				"Do you want to continue?",
+				false
+			) == MODAL_CHOICE_YES;
+		} else {
+			return true;
+		}
+	} else if (choice == MODAL_CHOICE_NO) {
+		return true;
+	} else {
+		return false;
+	}
+}
+
+static void
+close_doc(CF_Coroutine coro) {
+	doc_modal_ctx_t ctx = *(doc_modal_ctx_t*)cf_coroutine_get_udata(coro);
+	if (!should_continue_after_saving_current_doc(coro, &ctx)) {
+		return;
+	}
+
+	int index = workspace_find_doc(ctx.workspace, ctx.tab);
+	if (index >= 0) {
+		workspace_close_doc(ctx.workspace, index);
+	}
+}
+
+static bool
+parse_shape(const void* content, size_t size, shape_t* shape) {
+	CF_JDoc jdoc = cf_make_json(content, size);
+	if (jdoc.id == 0) { return false; }
+
+	CF_JVal root = cf_json_get_root(jdoc);
+	CF_JVal vertices = cf_json_get(root, "vertices");
+	int num_vertices = cf_json_get_len(vertices);
+	if (num_vertices > MAX_NUM_VERTICES) { num_vertices = MAX_NUM_VERTICES; }
+
+	shape->num_vertices = 0;
+	for (int i = 0; i < num_vertices; ++i) {
+		CF_JVal jvert = cf_json_array_get(vertices, i);
+		CF_V2 vert = {
+			cf_json_get_float(cf_json_array_get(jvert, 0)),
+			cf_json_get_float(cf_json_array_get(jvert, 1)),
+		};
+		shape->verts[shape->num_vertices++] = vert;
+	}
+
+	cf_destroy_json(jdoc);
+	return true;
+}
+
+static bool
+load_doc(doc_modal_ctx_t* ctx, const char* path, const void* content, size_t size) {
+	shape_t loaded;
+	if (parse_shape(content, size, &loaded)) {
+		cf_free(ctx->doc->filename);
+		ctx->doc->filename = strclone(path);
+		ctx->doc->saved_version = 0;
+		ctx->doc->disk_hash = hash_bytes(HASH_SEED, content, size);
+		history_reset(ctx->history);
+		shape_t* shape = current_shape(ctx->history);
+		*shape = loaded;
+
+		ctx->workspace->journal_dirty = true;
+		return true;
+	} else {
+		show_text_popup(ctx->text_popup, "Could not load file");
+		return false;
+	}
+}
+
+#ifndef __EMSCRIPTEN__
+
+// Changes made by another program come in as a new edit so they can be
+// undone. Our own saves are recognized by their hash and skipped. A tab
+// with unsaved edits stays unsaved, undo gets those edits back.
+static void
+reload_doc(workspace_t* workspace, workspace_doc_t* tab) {
+	size_t size = 0;
+	void* content = load_file_into_memory(tab->doc.filename, &size);
+	if (content == NULL) { return; }
+
+	uint64_t hash = hash_bytes(HASH_SEED, content, size);
+	shape_t loaded;
+	if (hash != tab->doc.disk_hash && parse_shape(content, size, &loaded)) {
+		tab->doc.disk_hash = hash;
+		bool was_saved = tab->doc.saved_version == current_shape_version(tab->history);
+
+		shape_t* shape = current_shape(tab->history);
+		if (
+			shape->num_vertices != loaded.num_vertices
+			||
+			memcmp(shape->verts, loaded.verts, sizeof(CF_V2) * loaded.num_vertices) != 0
+		) {
+			shape = commit_shape(tab->history);
+			*shape = loaded;
+		}
+		if (was_saved) {
+			tab->doc.saved_version = current_shape_version(tab->history);
+		}
+		workspace->journal_dirty = true;
+	}
+	cf_free(content);
+}
+
+#endif
+
+// Loads into the active tab if it is still blank, a new one otherwise
+static void
+load_doc_into_workspace(doc_modal_ctx_t* ctx, const char* path, const void* content, size_t size) {
+	workspace_t* workspace = ctx->workspace;
+	int previous_active = workspace->active;
+
+	doc_modal_ctx_t target = *ctx;
+	bool added = false;
+	if (!workspace_doc_is_pristine(ctx->tab)) {
+		target.tab = workspace_add_doc(workspace);
+		added = true;
+	}
+	target.doc = &target.tab->doc;
+	target.history = target.tab->history;
+
+	if (!load_doc(&target, path, content, size) && added) {
+		workspace_close_doc(workspace, alen(workspace->docs) - 1);
+		workspace->active = previous_active;
+	}
+}
+
+// Import
+//
+// SVG and Tiled files are read in a single pass over their text without
+// building a tree. Curves are flattened to IMPORT_TOLERANCE and outlines
+// with more than MAX_NUM_VERTICES are simplified until they fit.
+//
+// Everything is flipped to y up. SVG is centered on its view box so it
+// lines up with a sprite of the same size, Tiled objects are relative to
+// their own position.
+
+static bool
+is_import_path(const char* path) {
+	return str_ends_with(path, ".svg")
+		|| str_ends_with(path, ".tmx")
+		|| str_ends_with(path, ".tmj");
+}
+
+static bool
+span_is(const char* str, int len, const char* literal) {
+	return (int)strlen(literal) == len && memcmp(str, literal, len) == 0;
+}
+
+static bool
+is_whitespace(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// No terminator needed and much faster than strtof on large files. Not
+// correctly rounded in the last digit, which coordinates can live with.
+static bool
+parse_float(const char** cursor, const char* end, float* out) {
+	const char* itr = *cursor;
+	bool negative = false;
+	if (itr < end && (*itr == '-' || *itr == '+')) {
+		negative = *itr == '-';
+		++itr;
+	}
+
+	double value = 0.0;
+	bool has_digits = false;
+	while (itr < end && *itr >= '0' && *itr <= '9') {
+		value = value * 10.0 + (*itr - '0');
+		has_digits = true;
+		++itr;
+	}
+	if (itr < end && *itr == '.') {
+		++itr;
+		double scale = 0.1;
+		while (itr < end && *itr >= '0' && *itr <= '9') {
+			value += (*itr - '0') * scale;
+			scale *= 0.1;
+			has_digits = true;
+			++itr;
+		}
+	}
+	if (!has_digits) { return false; }
+
+	// An exponent needs digits, otherwise the 'e' belongs to whatever follows
+	if (itr < end && (*itr == 'e' || *itr == 'E')) {
+		const char* exponent_itr = itr + 1;
+		bool negative_exponent = false;
+		if (exponent_itr < end && (*exponent_itr == '-' || *exponent_itr == '+')) {
+			negative_exponent = *exponent_itr == '-';
+			++exponent_itr;
+		}
+
+		int exponent = 0;
+		bool has_exponent = false;
+		while (exponent_itr < end && *exponent_itr >= '0' && *exponent_itr <= '9') {
+			if (exponent < 1000) {
+				exponent = exponent * 10 + (*exponent_itr - '0');
+			}
+			has_exponent = true;
+			++exponent_itr;
+		}
+
+		if (has_exponent) {
+			value *= pow(10.0, negative_exponent ? -exponent : exponent);
+			itr = exponent_itr;
+		}
+	}
+
+	*out = (float)(negative ? -value : value);
+	*cursor = itr;
+	return true;
+}
+
+// Numbers in SVG and Tiled lists are separated by whitespace and commas
+static bool
+read_list_float(const char** cursor, const char* end, float* out) {
+	const char* itr = *cursor;
+	while (itr < end && (is_whitespace(*itr) || *itr == ',')) { ++itr; }
+	*cursor = itr;
+	return parse_float(cursor, end, out);
+}
+
+static affine_t
+affine_identity(void) {
+	return (affine_t){ 1.f, 0.f, 0.f, 1.f, 0.f, 0.f };
+}
+
+// q is applied first
+static affine_t
+affine_mul(affine_t p, affine_t q) {
+	return (affine_t){
+		p.a * q.a + p.c * q.b,
+		p.b * q.a + p.d * q.b,
+		p.a * q.c + p.c * q.d,
+		p.b * q.c + p.d * q.d,
+		p.a * q.e + p.c * q.f + p.e,
+		p.b * q.e + p.d * q.f + p.f,
+	};
+}
+
+static CF_V2
+affine_apply(const affine_t* t, CF_V2 p) {
+	return cf_v2(t->a * p.x + t->c * p.y + t->e, t->b * p.x + t->d * p.y + t->f);
+}
+
+// Tolerance in the space of the file for IMPORT_TOLERANCE after transform
+static float
+affine_tolerance(const affine_t* t) {
+	float scale = sqrtf(fabsf(t->a * t->d - t->b * t->c));
+	return IMPORT_TOLERANCE / fmaxf(scale, 1e-6f);
+}
+
+// Output
+
+static void
+import_clear(import_t* import) {
+	cf_free(import->source);
+	import->source = NULL;
+	aclear(import->verts);
+	aclear(import->names);
+	aclear(import->objects);
+	aclear(import->points);
+	import->num_batch_opened = 0;
+}
+
+static void
+import_cleanup(import_t* import) {
+	cf_free(import->source);
+	afree(import->verts);
+	afree(import->names);
+	afree(import->objects);
+	afree(import->points);
+	afree(import->raw);
+	afree(import->simplified);
+	polyline_lod_cleanup(&import->simplify);
+}
+
+static const char*
+import_object_name(const import_t* import, int index) {
+	return import->names + import->objects[index].name;
+}
+
+static void
+import_add_point(import_t* import, const affine_t* transform, CF_V2 p) {
+	p = affine_apply(transform, p);
+	int n = alen(import->points);
+	if (n == 0 || import->points[n - 1].x != p.x || import->points[n - 1].y != p.y) {
+		apush(import->points, p);
+	}
+}
+
+// Turns the points collected so far into an object
+static void
+import_finish_outline(import_t* import, const char* name, int name_len) {
+	const CF_V2* verts = import->points;
+	int num_points = alen(import->points);
+	if (
+		num_points > 1
+		&&
+		verts[0].x == verts[num_points - 1].x && verts[0].y == verts[num_points - 1].y
+	) {
+		--num_points;
+	}
+
+	// Each pass starts over from the full outline with twice the tolerance
+	int num_vertices = num_points;
+	float tolerance = IMPORT_TOLERANCE;
+	while (num_vertices > MAX_NUM_VERTICES) {
+		polyline_lod_build(&import->simplify, &import->simplified, import->points, num_points, tolerance);
+		verts = import->simplified;
+		num_vertices = alen(import->simplified);
+		tolerance *= 2.f;
+	}
+
+	if (num_vertices >= 3) {
+		import_object_t object = {
+			.name = alen(import->names),
+			.first_vertex = alen(import->verts),
+			.num_vertices = num_vertices,
+		};
+
+		char fallback[32];
+		if (name_len <= 0) {
+			name = fallback;
+			name_len = snprintf(fallback, sizeof(fallback), "object %d", alen(import->objects) + 1);
+		}
+		for (int i = 0; i < name_len; ++i) {
+			apush(import->names, name[i]);
+		}
+		apush(import->names, '\0');
+
+		for (int i = 0; i < num_vertices; ++i) {
+			apush(import->verts, verts[i]);
+		}
+		apush(import->objects, object);
+	}
+
+	aclear(import->points);
+}
+
+static CF_V2
+midpoint(CF_V2 a, CF_V2 b) {
+	return cf_mul(cf_add(a, b), 0.5f);
+}
+
+// Splits the curve in halves until its control points are within
+// tolerance of the chord. Right halves go on the stack first so the
+// points come out in order.
+static void
+import_cubic(import_t* import, const affine_t* transform, CF_V2 p0, CF_V2 p1, CF_V2 p2, CF_V2 p3, float tolerance) {
+	bezier_t stack[IMPORT_MAX_SUBDIVISIONS + 1];
+	int top = 0;
+	stack[top++] = (bezier_t){ { p0, p1, p2, p3 }, 0 };
+
+	float limit = 16.f * tolerance * tolerance;
+	while (top > 0) {
+		bezier_t curve = stack[--top];
+		const CF_V2* c = curve.p;
+
+		float ux = 3.f * c[1].x - 2.f * c[0].x - c[3].x;
+		float uy = 3.f * c[1].y - 2.f * c[0].y - c[3].y;
+		float vx = 3.f * c[2].x - c[0].x - 2.f * c[3].x;
+		float vy = 3.f * c[2].y - c[0].y - 2.f * c[3].y;
+		float flatness = fmaxf(ux * ux, vx * vx) + fmaxf(uy * uy, vy * vy);
+		if (flatness <= limit || curve.depth >= IMPORT_MAX_SUBDIVISIONS) {
+			import_add_point(import, transform, c[3]);
+			continue;
+		}
+
+		CF_V2 ab = midpoint(c[0], c[1]);
+		CF_V2 bc = midpoint(c[1], c[2]);
+		CF_V2 cd = midpoint(c[2], c[3]);
+		CF_V2 abc = midpoint(ab, bc);
+		CF_V2 bcd = midpoint(bc, cd);
+		CF_V2 mid = midpoint(abc, bcd);
+		stack[top++] = (bezier_t){ { mid, bcd, cd, c[3] }, curve.depth + 1 };
+		stack[top++] = (bezier_t){ { c[0], ab, abc, mid }, curve.depth + 1 };
+	}
+}
+
+static void
+import_quadratic(import_t* import, const affine_t* transform, CF_V2 p0, CF_V2 p1, CF_V2 p2, float tolerance) {
+	CF_V2 c1 = cf_add(p0, cf_mul(cf_sub(p1, p0), 2.f / 3.f));
+	CF_V2 c2 = cf_add(p2, cf_mul(cf_sub(p1, p2), 2.f / 3.f));
+	import_cubic(import, transform, p0, c1, c2, p2, tolerance);
+}
+
+// Segments for an arc to stay within tolerance of the true curve
+static int
+import_arc_segments(float radius, float angle, float tolerance) {
+	float step = radius > tolerance ? 2.f * acosf(1.f - tolerance / radius) : CF_PI;
+	int segments = (int)ceilf(fabsf(angle) / step);
+	if (segments < 1) { segments = 1; }
+	if (segments > IMPORT_MAX_ARC_SEGMENTS) { segments = IMPORT_MAX_ARC_SEGMENTS; }
+	return segments;
+}
+
+static void
+import_ellipse(import_t* import, const affine_t* transform, CF_V2 center, float rx, float ry, float tolerance) {
+	int segments = import_arc_segments(fmaxf(rx, ry), 2.f * CF_PI, tolerance);
+	if (segments < 8) { segments = 8; }
+
+	for (int i = 0; i < segments; ++i) {
+		float angle = 2.f * CF_PI * (float)i / (float)segments;
+		import_add_point(import, transform, cf_v2(center.x + rx * cosf(angle), center.y + ry * sinf(angle)));
+	}
+}
+
+static float
+vector_angle(CF_V2 u, CF_V2 v) {
+	return atan2f(u.x * v.y - u.y * v.x, u.x * v.x + u.y * v.y);
+}
+
+// Endpoint to center conversion from the SVG implementation notes
+static void
+import_arc(
+	import_t* import, const affine_t* transform,
+	CF_V2 p0, float rx, float ry, float rotation, bool large_arc, bool sweep, CF_V2 p1,
+	float tolerance
+) {
+	rx = fabsf(rx);
+	ry = fabsf(ry);
+	if (rx == 0.f || ry == 0.f || (p0.x == p1.x && p0.y == p1.y)) {
+		import_add_point(import, transform, p1);
+		return;
+	}
+
+	float cos_phi = cosf(rotation * CF_PI / 180.f);
+	float sin_phi = sinf(rotation * CF_PI / 180.f);
+	float dx = (p0.x - p1.x) * 0.5f;
+	float dy = (p0.y - p1.y) * 0.5f;
+	float x1 = cos_phi * dx + sin_phi * dy;
+	float y1 = -sin_phi * dx + cos_phi * dy;
+
+	// Radii too small to reach the end point are scaled up
+	float lambda = (x1 * x1) / (rx * rx) + (y1 * y1) / (ry * ry);
+	if (lambda > 1.f) {
+		rx *= sqrtf(lambda);
+		ry *= sqrtf(lambda);
+	}
+
+	float numerator = rx * rx * ry * ry - rx * rx * y1 * y1 - ry * ry * x1 * x1;
+	float denominator = rx * rx * y1 * y1 + ry * ry * x1 * x1;
+	float coefficient = sqrtf(fmaxf(0.f, numerator / denominator));
+	if (large_arc == sweep) { coefficient = -coefficient; }
+	float cx1 = coefficient * rx * y1 / ry;
+	float cy1 = -coefficient * ry * x1 / rx;
+	float cx = cos_phi * cx1 - sin_phi * cy1 + (p0.x + p1.x) * 0.5f;
+	float cy = sin_phi * cx1 + cos_phi * cy1 + (p0.y + p1.y) * 0.5f;
+
+	CF_V2 u = cf_v2((x1 - cx1) / rx, (y1 - cy1) / ry);
+	CF_V2 v = cf_v2((-x1 - cx1) / rx, (-y1 - cy1) / ry);
+	float start_angle = vector_angle(cf_v2(1.f, 0.f), u);
+	float delta_angle = vector_angle(u, v);
+	if (!sweep && delta_angle > 0.f) { delta_angle -= 2.f * CF_PI; }
+	if (sweep && delta_angle < 0.f) { delta_angle += 2.f * CF_PI; }
+
+	int segments = import_arc_segments(fmaxf(rx, ry), delta_angle, tolerance);
+	for (int i = 1; i < segments; ++i) {
+		float angle = start_angle + delta_angle * (float)i / (float)segments;
+		float x = rx * cosf(angle);
+		float y = ry * sinf(angle);
+		import_add_point(import, transform, cf_v2(cx + cos_phi * x - sin_phi * y, cy + sin_phi * x + cos_phi * y));
+	}
+	import_add_point(import, transform, p1);
+}
+
+static void
+import_point_list(import_t* import, const affine_t* transform, const char* value, int len) {
+	const char* itr = value;
+	const char* end = value + len;
+	CF_V2 p;
+	while (read_list_float(&itr, end, &p.x) && read_list_float(&itr, end, &p.y)) {
+		import_add_point(import, transform, p);
+	}
+}
+
+static void
+import_rect(import_t* import, const affine_t* transform, float x, float y, float width, float height) {
+	if (width <= 0.f || height <= 0.f) { return; }
+
+	import_add_point(import, transform, cf_v2(x, y));
+	import_add_point(import, transform, cf_v2(x + width, y));
+	import_add_point(import, transform, cf_v2(x + width, y + height));
+	import_add_point(import, transform, cf_v2(x, y + height));
+}
+
+// XML
+
+static const char*
+find_span(const char* itr, const char* end, const char* literal) {
+	size_t len = strlen(literal);
+	while ((size_t)(end - itr) >= len) {
+		const char* found = memchr(itr, literal[0], end - itr - len + 1);
+		if (found == NULL) { return NULL; }
+		if (memcmp(found, literal, len) == 0) { return found; }
+		itr = found + 1;
+	}
+	return NULL;
+}
+
+// Moves to the next start or end tag. Text, comments, CDATA and
+// declarations are skipped over. Entities are not decoded.
+static bool
+xml_next_tag(xml_reader_t* reader) {
+	const char* end = reader->end;
+	while (true) {
+		const char* itr = memchr(reader->cursor, '<', end - reader->cursor);
+		if (itr == NULL) { return false; }
+		++itr;
+
+		if (itr < end && (*itr == '!' || *itr == '?')) {
+			const char* skip_to;
+			if (end - itr >= 3 && memcmp(itr, "!--", 3) == 0) {
+				skip_to = find_span(itr, end, "-->");
+			} else if (end - itr >= 8 && memcmp(itr, "![CDATA[", 8) == 0) {
+				skip_to = find_span(itr, end, "]]>");
+			} else {
+				skip_to = memchr(itr, '>', end - itr);
+			}
+			if (skip_to == NULL) { return false; }
+
+			reader->cursor = skip_to + 1;
+			continue;
+		}
+
+		reader->closing = itr < end && *itr == '/';
+		if (reader->closing) { ++itr; }
+		reader->name = itr;
+		while (itr < end && !is_whitespace(*itr) && *itr != '>' && *itr != '/') { ++itr; }
+		reader->name_len = (int)(itr - reader->name);
+		reader->self_closing = false;
+		reader->num_attrs = 0;
+
+		while (true) {
+			while (itr < end && is_whitespace(*itr)) { ++itr; }
+			if (itr >= end) { return false; }
+			if (*itr == '>') {
+				++itr;
+				break;
+			}
+			if (*itr == '/') {
+				reader->self_closing = true;
+				++itr;
+				continue;
+			}
+
+			xml_attr_t attr = { .name = itr };
+			while (itr < end && !is_whitespace(*itr) && *itr != '=' && *itr != '>' && *itr != '/') { ++itr; }
+			attr.name_len = (int)(itr - attr.name);
+			while (itr < end && is_whitespace(*itr)) { ++itr; }
+			if (itr < end && *itr == '=') {
+				++itr;
+				while (itr < end && is_whitespace(*itr)) { ++itr; }
+				if (itr < end && (*itr == '"' || *itr == '\'')) {
+					const char* close = memchr(itr + 1, *itr, end - itr - 1);
+					if (close == NULL) { return false; }
+					attr.value = itr + 1;
+					attr.value_len = (int)(close - attr.value);
+					itr = close + 1;
+				} else {
+					attr.value = itr;
+					while (itr < end && !is_whitespace(*itr) && *itr != '>') { ++itr; }
+					attr.value_len = (int)(itr - attr.value);
+				}
+			}
+
+			if (attr.name_len == 0) {
+				++itr;  // Stray character, keep going
+			} else if (reader->num_attrs < XML_MAX_ATTRS) {
+				reader->attrs[reader->num_attrs++] = attr;
+			}
+		}
+
+		reader->cursor = itr;
+		return true;
+	}
+}
+
+static bool
+xml_tag_is(const xml_reader_t* reader, const char* name) {
+	return span_is(reader->name, reader->name_len, name);
+}
+
+static bool
+xml_attr(const xml_reader_t* reader, const char* name, const char** value, int* value_len) {
+	for (int i = 0; i < reader->num_attrs; ++i) {
+		const xml_attr_t* attr = &reader->attrs[i];
+		if (span_is(attr->name, attr->name_len, name)) {
+			*value = attr->value;
+			*value_len = attr->value_len;
+			return true;
+		}
+	}
+	return false;
+}
+
+static float
+xml_attr_float(const xml_reader_t* reader, const char* name, float fallback) {
+	const char* value;
+	int len;
+	float result;
+	if (xml_attr(reader, name, &value, &len) && read_list_float(&value, value + len, &result)) {
+		return result;
+	}
+	return fallback;
+}
+
+// SVG
+
+static affine_t
+svg_parse_transform(const char* value, int len) {
+	affine_t result = affine_identity();
+	const char* itr = value;
+	const char* end = value + len;
+	while (true) {
+		while (itr < end && (is_whitespace(*itr) || *itr == ',')) { ++itr; }
+		const char* name = itr;
+		while (itr < end && *itr != '(' && !is_whitespace(*itr)) { ++itr; }
+		int name_len = (int)(itr - name);
+		while (itr < end && is_whitespace(*itr)) { ++itr; }
+		if (itr >= end || *itr != '(') { break; }
+		++itr;
+
+		float v[6];
+		int count = 0;
+		while (count < 6 && read_list_float(&itr, end, &v[count])) { ++count; }
+		itr = memchr(itr, ')', end - itr);
+		if (itr == NULL || count == 0) { break; }
+		++itr;
+
+		affine_t t = affine_identity();
+		if (span_is(name, name_len, "matrix") && count == 6) {
+			t = (affine_t){ v[0], v[1], v[2], v[3], v[4], v[5] };
+		} else if (span_is(name, name_len, "translate")) {
+			t.e = v[0];
+			t.f = count > 1 ? v[1] : 0.f;
+		} else if (span_is(name, name_len, "scale")) {
+			t.a = v[0];
+			t.d = count > 1 ? v[1] : v[0];
+		} else if (span_is(name, name_len, "rotate")) {
+			float c = cosf(v[0] * CF_PI / 180.f);
+			float s = sinf(v[0] * CF_PI / 180.f);
+			t = (affine_t){ c, s, -s, c, 0.f, 0.f };
+			if (count == 3) {
+				t = affine_mul((affine_t){ 1.f, 0.f, 0.f, 1.f, v[1], v[2] }, t);
+				t = affine_mul(t, (affine_t){ 1.f, 0.f, 0.f, 1.f, -v[1], -v[2] });
+			}
+		} else if (span_is(name, name_len, "skewX")) {
+			t.c = tanf(v[0] * CF_PI / 180.f);
+		} else if (span_is(name, name_len, "skewY")) {
+			t.b = tanf(v[0] * CF_PI / 180.f);
+		}
+		result = affine_mul(result, t);
+	}
+	return result;
+}
+
+// Centers the view box on the origin, scaled to the size of the document
+static affine_t
+svg_view_transform(const xml_reader_t* reader) {
+	float width = xml_attr_float(reader, "width", 0.f);
+	float height = xml_attr_float(reader, "height", 0.f);
+	float view[4] = { 0.f, 0.f, width, height };
+
+	const char* value;
+	int len;
+	if (xml_attr(reader, "viewBox", &value, &len)) {
+		const char* itr = value;
+		float box[4];
+		int count = 0;
+		while (count < 4 && read_list_float(&itr, value + len, &box[count])) { ++count; }
+		if (count == 4 && box[2] > 0.f && box[3] > 0.f) {
+			memcpy(view, box, sizeof(view));
+		}
+	}
+
+	float sx = width > 0.f && view[2] > 0.f ? width / view[2] : 1.f;
+	float sy = height > 0.f && view[3] > 0.f ? height / view[3] : 1.f;
+	float cx = view[0] + view[2] * 0.5f;
+	float cy = view[1] + view[3] * 0.5f;
+	return (affine_t){ sx, 0.f, 0.f, sy, -sx * cx, -sy * cy };
+}
+
+static bool
+svg_read_floats(const char** cursor, const char* end, float* out, int count) {
+	for (int i = 0; i < count; ++i) {
+		if (!read_list_float(cursor, end, &out[i])) { return false; }
+	}
+	return true;
+}
+
+// Arc flags may be written without separators, as in "a1 1 0 01 1 1"
+static bool
+svg_read_flag(const char** cursor, const char* end, bool* out) {
+	const char* itr = *cursor;
+	while (itr < end && (is_whitespace(*itr) || *itr == ',')) { ++itr; }
+	if (itr >= end || (*itr != '0' && *itr != '1')) { return false; }
+
+	*out = *itr == '1';
+	*cursor = itr + 1;
+	return true;
+}
+
+// Every subpath becomes its own object
+static void
+svg_import_path(import_t* import, const affine_t* transform, const char* d, int len, const char* name, int name_len) {
+	const char* itr = d;
+	const char* end = d + len;
+	float tolerance = affine_tolerance(transform);
+
+	char command = 0;
+	char previous = 0;  // Lower case, for reflecting control points
+	CF_V2 current = { 0 };
+	CF_V2 start = { 0 };
+	CF_V2 control = { 0 };
+	while (true) {
+		while (itr < end && (is_whitespace(*itr) || *itr == ',')) { ++itr; }
+		if (itr >= end) { break; }
+
+		char c = *itr;
+		if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')) {
+			command = c;
+			++itr;
+			if (c == 'z' || c == 'Z') {
+				import_finish_outline(import, name, name_len);
+				current = start;
+				previous = 'z';
+				continue;
+			}
+		} else if (command == 0) {
+			break;
+		}
+
+		char lower = command | 0x20;
+		bool relative = command == lower;
+		CF_V2 origin = relative ? current : cf_v2(0.f, 0.f);
+
+		float v[7];
+		bool large_arc = false;
+		bool sweep = false;
+		bool ok = false;
+		switch (lower) {
+			case 'm': case 'l': case 't': ok = svg_read_floats(&itr, end, v, 2); break;
+			case 'h': case 'v': ok = svg_read_floats(&itr, end, v, 1); break;
+			case 'c': ok = svg_read_floats(&itr, end, v, 6); break;
+			case 's': case 'q': ok = svg_read_floats(&itr, end, v, 4); break;
+			case 'a': {
+				ok = svg_read_floats(&itr, end, v, 3)
+					&& svg_read_flag(&itr, end, &large_arc)
+					&& svg_read_flag(&itr, end, &sweep)
+					&& svg_read_floats(&itr, end, v + 5, 2);
+			} break;
+		}
+		if (!ok) { break; }
+
+		// Drawing right after a close starts from where the last subpath began
+		if (lower != 'm' && alen(import->points) == 0) {
+			import_add_point(import, transform, current);
+		}
+
+		bool cubic_before = previous == 'c' || previous == 's';
+		bool quadratic_before = previous == 'q' || previous == 't';
+		CF_V2 reflected = cf_sub(cf_mul(current, 2.f), control);
+		switch (lower) {
+			case 'm': {
+				import_finish_outline(import, name, name_len);
+				current = start = cf_add(origin, cf_v2(v[0], v[1]));
+				import_add_point(import, transform, current);
+				// Further pairs are implicit line segments
+				command = relative ? 'l' : 'L';
+			} break;
+			case 'l': {
+				current = cf_add(origin, cf_v2(v[0], v[1]));
+				import_add_point(import, transform, current);
+			} break;
+			case 'h': {
+				current.x = origin.x + v[0];
+				import_add_point(import, transform, current);
+			} break;
+			case 'v': {
+				current.y = origin.y + v[0];
+				import_add_point(import, transform, current);
+			} break;
+			case 'c': case 's': {
+				CF_V2 c1;
+				CF_V2 c2;
+				CF_V2 p;
+				if (lower == 'c') {
+					c1 = cf_add(origin, cf_v2(v[0], v[1]));
+					c2 = cf_add(origin, cf_v2(v[2], v[3]));
+					p = cf_add(origin, cf_v2(v[4], v[5]));
+				} else {
+					c1 = cubic_before ? reflected : current;
+					c2 = cf_add(origin, cf_v2(v[0], v[1]));
+					p = cf_add(origin, cf_v2(v[2], v[3]));
+				}
+				import_cubic(import, transform, current, c1, c2, p, tolerance);
+				control = c2;
+				current = p;
+			} break;
+			case 'q': case 't': {
+				CF_V2 q;
+				CF_V2 p;
+				if (lower == 'q') {
+					q = cf_add(origin, cf_v2(v[0], v[1]));
+					p = cf_add(origin, cf_v2(v[2], v[3]));
+				} else {
+					q = quadratic_before ? reflected : current;
+					p = cf_add(origin, cf_v2(v[0], v[1]));
+				}
+				import_quadratic(import, transform, current, q, p, tolerance);
+				control = q;
+				current = p;
+			} break;
+			case 'a': {
+				CF_V2 p = cf_add(origin, cf_v2(v[5], v[6]));
+				import_arc(import, transform, current, v[0], v[1], v[2], large_arc, sweep, p, tolerance);
+				current = p;
+			} break;
+		}
+		previous = lower;
+	}
+
+	import_finish_outline(import, name, name_len);
+}
+
+static void
+svg_import_element(import_t* import, const xml_reader_t* reader, const affine_t* transform) {
+	const char* name = NULL;
+	int name_len = 0;
+	xml_attr(reader, "id", &name, &name_len);
+
+	const char* value;
+	int len;
+	if (xml_tag_is(reader, "path")) {
+		if (xml_attr(reader, "d", &value, &len)) {
+			svg_import_path(import, transform, value, len, name, name_len);
+		}
+		return;
+	} else if (xml_tag_is(reader, "polygon") || xml_tag_is(reader, "polyline")) {
+		if (xml_attr(reader, "points", &value, &len)) {
+			import_point_list(import, transform, value, len);
+		}
+	} else if (xml_tag_is(reader, "rect")) {
+		import_rect(
+			import, transform,
+			xml_attr_float(reader, "x", 0.f),
+			xml_attr_float(reader, "y", 0.f),
+			xml_attr_float(reader, "width", 0.f),
+			xml_attr_float(reader, "height", 0.f)
+		);
+	} else if (xml_tag_is(reader, "circle") || xml_tag_is(reader, "ellipse")) {
+		CF_V2 center = cf_v2(xml_attr_float(reader, "cx", 0.f), xml_attr_float(reader, "cy", 0.f));
+		float r = xml_attr_float(reader, "r", 0.f);
+		float rx = xml_attr_float(reader, "rx", r);
+		float ry = xml_attr_float(reader, "ry", r);
+		if (rx > 0.f && ry > 0.f) {
+			import_ellipse(import, transform, center, rx, ry, affine_tolerance(transform));
+		}
+	} else {
+		return;
+	}
+
+	import_finish_outline(import, name, name_len);
+}
+
+// Content of these is only drawn when referenced from elsewhere
+static bool
+svg_is_hidden_container(const xml_reader_t* reader) {
+	return xml_tag_is(reader, "defs")
+		|| xml_tag_is(reader, "clipPath")
+		|| xml_tag_is(reader, "mask")
+		|| xml_tag_is(reader, "symbol")
+		|| xml_tag_is(reader, "pattern")
+		|| xml_tag_is(reader, "marker");
+}
+
+static void
+svg_import(import_t* import, const char* content, size_t size) {
+	xml_reader_t reader = { .cursor = content, .end = content + size };
+
+	// Transforms of the open elements, anything nested deeper is skipped
+	affine_t transforms[IMPORT_MAX_DEPTH];
+	transforms[0] = (affine_t){ 1.f, 0.f, 0.f, -1.f, 0.f, 0.f };
+	int depth = 0;
+	int hidden_depth = -1;
+	bool has_root = false;
+	while (xml_next_tag(&reader)) {
+		if (reader.closing) {
+			if (depth > 0) { --depth; }
+			if (hidden_depth >= 0 && depth < hidden_depth) { hidden_depth = -1; }
+			continue;
+		}
+
+		if (depth >= IMPORT_MAX_DEPTH) {
+			if (!reader.self_closing) { ++depth; }
+			continue;
+		}
+
+		affine_t transform = transforms[depth];
+		if (!has_root && xml_tag_is(&reader, "svg")) {
+			transform = affine_mul(transform, svg_view_transform(&reader));
+			has_root = true;
+		}
+
+		const char* value;
+		int len;
+		if (xml_attr(&reader, "transform", &value, &len)) {
+			transform = affine_mul(transform, svg_parse_transform(value, len));
+		}
+
+		if (hidden_depth < 0) {
+			if (svg_is_hidden_container(&reader)) {
+				if (!reader.self_closing) { hidden_depth = depth + 1; }
+			} else {
+				svg_import_element(import, &reader, &transform);
+			}
+		}
+
+		if (!reader.self_closing) {
+			++depth;
+			if (depth < IMPORT_MAX_DEPTH) { transforms[depth] = transform; }
+		}
+	}
+}
+
+// Tiled
+
+// Objects rotate clockwise around their position in y down
+static affine_t
+tiled_object_transform(float rotation) {
+	float c = cosf(rotation * CF_PI / 180.f);
+	float s = sinf(rotation * CF_PI / 180.f);
+	return (affine_t){ c, -s, -s, -c, 0.f, 0.f };
+}
+
+// Rectangles and ellipses span the object size from its position
+static void
+tiled_import_area(import_t* import, const affine_t* transform, bool ellipse, float width, float height) {
+	if (ellipse) {
+		if (width > 0.f && height > 0.f) {
+			CF_V2 center = cf_v2(width * 0.5f, height * 0.5f);
+			import_ellipse(import, transform, center, width * 0.5f, height * 0.5f, IMPORT_TOLERANCE);
+		}
+	} else {
+		import_rect(import, transform, 0.f, 0.f, width, height);
+	}
+}
+
+static void
+tmx_import(import_t* import, const char* content, size_t size) {
+	xml_reader_t reader = { .cursor = content, .end = content + size };
+
+	bool in_object = false;
+	bool has_shape = false;
+	const char* name = NULL;
+	int name_len = 0;
+	float width = 0.f;
+	float height = 0.f;
+	affine_t transform = affine_identity();
+	while (xml_next_tag(&reader)) {
+		if (reader.closing) {
+			if (in_object && xml_tag_is(&reader, "object")) {
+				if (!has_shape) {
+					tiled_import_area(import, &transform, false, width, height);
+					import_finish_outline(import, name, name_len);
+				}
+				in_object = false;
+			}
+			continue;
+		}
+
+		const char* value;
+		int len;
+		if (xml_tag_is(&reader, "object")) {
+			name = NULL;
+			name_len = 0;
+			xml_attr(&reader, "name", &name, &name_len);
+			width = xml_attr_float(&reader, "width", 0.f);
+			height = xml_attr_float(&reader, "height", 0.f);
+			transform = tiled_object_transform(xml_attr_float(&reader, "rotation", 0.f));
+			// Tile objects are images, not outlines
+			has_shape = xml_attr(&reader, "gid", &value, &len);
+
+			if (!reader.self_closing) {
+				in_object = true;
+			} else if (!has_shape) {
+				tiled_import_area(import, &transform, false, width, height);
+				import_finish_outline(import, name, name_len);
+			}
+		} else if (in_object && !has_shape) {
+			if (xml_tag_is(&reader, "polygon") || xml_tag_is(&reader, "polyline")) {
+				if (xml_attr(&reader, "points", &value, &len)) {
+					import_point_list(import, &transform, value, len);
+					import_finish_outline(import, name, name_len);
+				}
+				has_shape = true;
+			} else if (xml_tag_is(&reader, "ellipse")) {
+				tiled_import_area(import, &transform, true, width, height);
+				import_finish_outline(import, name, name_len);
+				has_shape = true;
+			} else if (xml_tag_is(&reader, "point") || xml_tag_is(&reader, "text")) {
+				has_shape = true;
+			}
+		}
+	}
+}
+
+static void
+json_skip_whitespace(json_reader_t* reader) {
+	while (reader->cursor < reader->end && is_whitespace(*reader->cursor)) { ++reader->cursor; }
+}
+
+static bool
+json_consume(json_reader_t* reader, char c) {
+	json_skip_whitespace(reader);
+	if (reader->cursor < reader->end && *reader->cursor == c) {
+		++reader->cursor;
+		return true;
+	}
+	return false;
+}
+
+static void
+json_expect(json_reader_t* reader, char c) {
+	if (!json_consume(reader, c)) { reader->failed = true; }
+}
+
+// Escapes are left as they are, which only matters for names
+static bool
+json_read_string(json_reader_t* reader, const char** str, int* len) {
+	if (!json_consume(reader, '"')) {
+		reader->failed = true;
+		return false;
+	}
+
+	const char* start = reader->cursor;
+	while (reader->cursor < reader->end && *reader->cursor != '"') {
+		if (*reader->cursor == '\\') { ++reader->cursor; }
+		++reader->cursor;
+	}
+	if (reader->cursor >= reader->end) {
+		reader->failed = true;
+		return false;
+	}
+
+	*str = start;
+	*len = (int)(reader->cursor - start);
+	++reader->cursor;
+	return true;
+}
+
+static float
+json_read_float(json_reader_t* reader) {
+	float value = 0.f;
+	json_skip_whitespace(reader);
+	if (!parse_float(&reader->cursor, reader->end, &value)) { reader->failed = true; }
+	return value;
+}
+
+// Steps over a value of any kind without looking into it
+static void
+json_skip_value(json_reader_t* reader) {
+	json_skip_whitespace(reader);
+	int depth = 0;
+	while (reader->cursor < reader->end) {
+		char c = *reader->cursor;
+		if (c == '"') {
+			const char* str;
+			int len;
+			if (!json_read_string(reader, &str, &len) || depth == 0) { return; }
+		} else if (c == '{' || c == '[') {
+			++depth;
+			++reader->cursor;
+		} else if (c == '}' || c == ']' || c == ',') {
+			// Ends a scalar at the top
+			if (depth == 0) { return; }
+			++reader->cursor;
+			if (c != ',' && --depth == 0) { return; }
+		} else {
+			++reader->cursor;
+		}
+	}
+	reader->failed = true;
+}
+
+static bool
+json_read_bool(json_reader_t* reader) {
+	json_skip_whitespace(reader);
+	bool value = reader->end - reader->cursor >= 4 && memcmp(reader->cursor, "true", 4) == 0;
+	json_skip_value(reader);
+	return value;
+}
+
+static void
+tmj_read_points(json_reader_t* reader, import_t* import) {
+	aclear(import->raw);
+	json_expect(reader, '[');
+	if (reader->failed || json_consume(reader, ']')) { return; }
+
+	do {
+		CF_V2 p = { 0 };
+		json_expect(reader, '{');
+		if (!reader->failed && !json_consume(reader, '}')) {
+			do {
+				const char* key;
+				int key_len;
+				if (!json_read_string(reader, &key, &key_len)) { break; }
+				json_expect(reader, ':');
+
+				if (span_is(key, key_len, "x")) {
+					p.x = json_read_float(reader);
+				} else if (span_is(key, key_len, "y")) {
+					p.y = json_read_float(reader);
+				} else {
+					json_skip_value(reader);
+				}
+			} while (!reader->failed && json_consume(reader, ','));
+			json_expect(reader, '}');
+		}
+		apush(import->raw, p);
+	} while (!reader->failed && json_consume(reader, ','));
+	json_expect(reader, ']');
+}
+
+static void
+tmj_import_object(json_reader_t* reader, import_t* import) {
+	json_expect(reader, '{');
+	if (reader->failed) { return; }
+
+	const char* name = NULL;
+	int name_len = 0;
+	float width = 0.f;
+	float height = 0.f;
+	float rotation = 0.f;
+	bool ellipse = false;
+	bool has_points = false;
+	bool skip = false;
+	if (!json_consume(reader, '}')) {
+		do {
+			const char* key;
+			int key_len;
+			if (!json_read_string(reader, &key, &key_len)) { break; }
+			json_expect(reader, ':');
+
+			if (span_is(key, key_len, "name")) {
+				json_read_string(reader, &name, &name_len);
+			} else if (span_is(key, key_len, "width")) {
+				width = json_read_float(reader);
+			} else if (span_is(key, key_len, "height")) {
+				height = json_read_float(reader);
+			} else if (span_is(key, key_len, "rotation")) {
+				rotation = json_read_float(reader);
+			} else if (span_is(key, key_len, "ellipse")) {
+				ellipse = json_read_bool(reader);
+			} else if (span_is(key, key_len, "point")) {
+				skip |= json_read_bool(reader);
+			} else if (span_is(key, key_len, "polygon") || span_is(key, key_len, "polyline")) {
+				tmj_read_points(reader, import);
+				has_points = true;
+			} else {
+				// Tile, text and template objects are not outlines
+				skip |= span_is(key, key_len, "gid")
+					|| span_is(key, key_len, "text")
+					|| span_is(key, key_len, "template");
+				json_skip_value(reader);
+			}
+		} while (!reader->failed && json_consume(reader, ','));
+		json_expect(reader, '}');
+	}
+	if (reader->failed || skip) { return; }
+
+	// Keys come in any order, so points wait for the rotation
+	affine_t transform = tiled_object_transform(rotation);
+	if (has_points) {
+		for (int i = 0; i < alen(import->raw); ++i) {
+			import_add_point(import, &transform, import->raw[i]);
+		}
+	} else {
+		tiled_import_area(import, &transform, ellipse, width, height);
+	}
+	import_finish_outline(import, name, name_len);
+}
+
+// Object lists can sit in any layer, including nested group layers
+static void
+tmj_import_value(json_reader_t* reader, import_t* import, bool objects) {
+	if (reader->failed) { return; }
+	if (++reader->depth > IMPORT_MAX_DEPTH) {
+		reader->failed = true;
+		return;
+	}
+
+	if (json_consume(reader, '{')) {
+		if (!json_consume(reader, '}')) {
+			do {
+				const char* key;
+				int key_len;
+				if (!json_read_string(reader, &key, &key_len)) { break; }
+				json_expect(reader, ':');
+				tmj_import_value(reader, import, span_is(key, key_len, "objects"));
+			} while (!reader->failed && json_consume(reader, ','));
+			json_expect(reader, '}');
+		}
+	} else if (json_consume(reader, '[')) {
+		if (!json_consume(reader, ']')) {
+			do {
+				if (objects) {
+					tmj_import_object(reader, import);
+				} else {
+					tmj_import_value(reader, import, false);
+				}
+			} while (!reader->failed && json_consume(reader, ','));
+			json_expect(reader, ']');
+		}
+	} else {
+		json_skip_value(reader);
+	}
+
+	--reader->depth;
+}
+
+// Replaces whatever was imported before, returns whether anything was found
+static bool
+import_file(import_t* import, const char* path, const void* content, size_t size) {
+	import_clear(import);
+	uint64_t start = cf_get_ticks();
+
+	const char* text = content;
+	if (str_ends_with(path, ".svg")) {
+		svg_import(import, text, size);
+	} else if (str_ends_with(path, ".tmx")) {
+		tmx_import(import, text, size);
+	} else {
+		json_reader_t reader = { .cursor = text, .end = text + size };
+		tmj_import_value(&reader, import, false);
+		if (reader.failed) {
+			import_clear(import);
+		}
+	}
+
+	import->seconds = (double)(cf_get_ticks() - start) / (double)cf_get_tick_frequency();
+	import->source = strclone(path_basename(path));
+	return alen(import->objects) > 0;
+}
+
+// Opens in the active tab if it is still blank, a new one otherwise.
+// The shape comes in as an edit so the tab shows up as unsaved.
+static workspace_doc_t*
+import_open_object(workspace_t* workspace, const import_t* import, int index) {
+	workspace_doc_t* tab = workspace_active_doc(workspace);
+	if (!workspace_doc_is_pristine(tab)) {
+		tab = workspace_add_doc(workspace);
+	}
+
+	cf_free(tab->doc.name);
+	tab->doc.name = strclone(import_object_name(import, index));
+	workspace->journal_dirty = true;
+
+	const import_object_t* object = &import->objects[index];
+	shape_t* shape = commit_shape(tab->history);
+	shape->num_vertices = object->num_vertices;
+	memcpy(shape->verts, import->verts + object->first_vertex, sizeof(CF_V2) * object->num_vertices);
+	return tab;
+}
+
+// Lists the objects of the last import until closed
+static void
+import_window(import_t* import, workspace_t* workspace, bool can_open) {
+	if (alen(import->objects) == 0) { return; }
+
+	bool open = true;
+	if (ImGui_Begin("Import", &open, ImGuiWindowFlags_None)) {
+		ImGui_Text(
+			"%s: %d objects in %.1f ms",
+			import->source, alen(import->objects), import->seconds * 1000.0
+		);
+
+		// Every tab is a full document with its own history, so large maps
+		// are opened one batch per click
+		int num_objects = alen(import->objects);
+		int num_remaining = num_objects - import->num_batch_opened;
+		int num_batch = num_remaining < IMPORT_MAX_OPEN_ALL ? num_remaining : IMPORT_MAX_OPEN_ALL;
+		char label[64];
+		if (num_batch == num_objects) {
+			snprintf(label, sizeof(label), "Open all");
+		} else {
+			snprintf(label, sizeof(label), "Open next %d", num_batch);
+		}
+
+		ImGui_BeginDisabled(!can_open);
+		ImGui_BeginDisabled(num_batch == 0);
+		if (ImGui_Button(label)) {
+			for (int i = 0; i < num_batch; ++i) {
+				import_open_object(workspace, import, import->num_batch_opened++);
+			}
+		}
+		ImGui_EndDisabled();
+		if (num_batch < num_objects) {
+			ImGui_SameLine();
+			ImGui_Text("%d of %d opened", import->num_batch_opened, num_objects);
+		}
+		ImGui_Separator();
+
+		ImGuiListClipper clipper = { 0 };
+		ImGuiListClipper_Begin(&clipper, alen(import->objects), -1.f);
+		while (ImGuiListClipper_Step(&clipper)) {
+			for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+				ImGui_PushIDInt(i);
+				if (ImGui_Selectable(import_object_name(import, i))) {
+					import_open_object(workspace, import, i);
+				}
+				ImGui_PopID();
 			}
-
-			ImGui_EndPopup();
 		}
-		cf_coroutine_yield(coro);
+		ImGuiListClipper_End(&clipper);
+		ImGui_EndDisabled();
 	}
+	ImGui_End();
 
-	return choice;
+	if (!open) {
+		import_clear(import);
+	}
 }
 
-static bool
-should_continue_after_saving_current_doc(
-	CF_Coroutine coro,
-	doc_modal_ctx_t* ctx
-) {
-	if (ctx->doc->saved_version == current_shape_version(ctx->history)) {
-		return true;
+// Files holding a single object open right away, the rest are listed in
+// the import window
+static void
+open_file(doc_modal_ctx_t* ctx, const char* path, const void* content, size_t size) {
+	if (!is_import_path(path)) {
+		load_doc_into_workspace(ctx, path, content, size);
+		return;
 	}
 
-	modal_choice_t choice = modal_confirm(
-		coro,
-		"There are unsaved changes.\n\n"
-		"Do you want to save first?",
-		true
-	);
+	import_t* import = ctx->import;
+	if (!import_file(import, path, content, size)) {
+		show_text_popup(ctx->text_popup, "No shapes found in file");
+	} else if (alen(import->objects) == 1) {
+		import_open_object(ctx->workspace, import, 0);
+		import_clear(import);
+	}
+}
 
-	if (choice == MODAL_CHOICE_YES) {
-		save_result_t save_result = save_doc(ctx);
-		if (save_result == SAVE_CANCELLED) {
-			return false;
-		} else if (save_result == SAVE_ERROR) {
-			return modal_confirm(
-				coro,
-				"Could not save changes.\n\n"
-				"Do you want to continue?",
-				false
-			) == MODAL_CHOICE_YES;
+static void
+open_doc(CF_Coroutine coro) {
+	doc_modal_ctx_t ctx = *(doc_modal_ctx_t*)cf_coroutine_get_udata(coro);
+
+#ifndef __EMSCRIPTEN__
+	nfdu8char_t* path = NULL;
+	nfdu8filteritem_t filters[] = {
+		{
+			.name = "Shapes",
+			.spec = "json,svg,tmx,tmj",
+		},
+		{
+			.name = "JSON",
+			.spec = "json",
+		},
+		{
+			.name = "SVG",
+			.spec = "svg",
+		},
+		{
+			.name = "Tiled map",
+			.spec = "tmx,tmj",
+		},
+	};
+	nfdresult_t open_result = NFD_OpenDialogU8(
+		&path,
+		filters, sizeof(filters) / sizeof(filters[0]),
+		NULL
+	);
+	if (open_result == NFD_OKAY) {
+		int open_index = workspace_find_file(ctx.workspace, path);
+		if (open_index >= 0) {
+			ctx.workspace->active = open_index;
+			ctx.workspace->select_active = true;
 		} else {
-			return true;
+			size_t size = 0;
+			void* content = load_file_into_memory(path, &size);
+			if (content != NULL) {
+				open_file(&ctx, path, content, size);
+			} else {
+				show_text_popup(ctx.text_popup, "Could not load file");
+			}
+			cf_free(content);
 		}
-	} else if (choice == MODAL_CHOICE_NO) {
-		return true;
-	} else {
-		return false;
+
+		NFD_FreePathU8(path);
+	} else if (open_result == NFD_ERROR) {
+		show_text_popup(ctx.text_popup, NFD_GetError());
+	}
+#else
+	web_file_t file = { 0 };
+	if (web_open_file(coro, ".json,.svg,.tmx,.tmj", false, &file)) {
+		open_file(&ctx, file.name, file.content, file.size);
 	}
+	free(file.name);
+	free(file.content);
+#endif
 }
 
 static void
-new_doc(CF_Coroutine coro) {
+recover_doc(CF_Coroutine coro) {
 	doc_modal_ctx_t ctx = *(doc_modal_ctx_t*)cf_coroutine_get_udata(coro);
-	if (!should_continue_after_saving_current_doc(coro, &ctx)) {
-		return;
+
+	size_t size = 0;
+	void* content = journal_load(ctx.journal, &size);
+	if (content != NULL && journal_has_edits(content, size)) {
+		modal_choice_t choice = modal_confirm(
+			coro,
+			"Unsaved changes from the last session were found.\n\n"
+			"Do you want to recover them?",
+			false
+		);
+
+		if (choice == MODAL_CHOICE_YES && !journal_replay(content, size, ctx.workspace, ctx.tab)) {
+			show_text_popup(ctx.text_popup, "Could not recover changes");
+		}
 	}
+	journal_free_content(content);
 
-	cf_free(ctx.doc->filename);
-	memset(ctx.doc, 0, sizeof(*ctx.doc));
-	memset(ctx.history, 0, sizeof(*ctx.history));
+	// Start a fresh journal from whatever state we ended up with
+	ctx.workspace->journal_dirty = true;
 }
 
+typedef struct {
+	text_popup_t* text_popup;
+	workspace_t* workspace;
+	workspace_doc_t* tab;
+} sprite_modal_ctx_t;
+
 static void
-load_doc(doc_modal_ctx_t* ctx, const char* path, const void* content, size_t size) {
-	CF_JDoc jdoc = cf_make_json(content, size);
+set_sprite(sprite_modal_ctx_t* ctx, sprite_cache_entry_t* entry) {
+	if (entry != NULL) {
+		workspace_doc_set_sprite(ctx->workspace, ctx->tab, entry);
+	} else {
+		show_text_popup(ctx->text_popup, "Could not load sprite");
+	}
+}
 
-	if (jdoc.id != 0) {
-		cf_free(ctx->doc->filename);
-		ctx->doc->filename = strclone(path);
-		ctx->doc->saved_version = 0;
-		memset(ctx->history, 0, sizeof(*ctx->history));
-		shape_t* shape = current_shape(ctx->history);
+#ifndef __EMSCRIPTEN__
 
-		CF_JVal root = cf_json_get_root(jdoc);
-		CF_JVal vertices = cf_json_get(root, "vertices");
-		int num_vertices = cf_json_get_len(vertices);
-		for (int i = 0; i < num_vertices; ++i) {
-			CF_JVal jvert = cf_json_array_get(vertices, i);
-			CF_V2 vert = {
-				cf_json_get_float(cf_json_array_get(jvert, 0)),
-				cf_json_get_float(cf_json_array_get(jvert, 1)),
-			};
-			shape->verts[shape->num_vertices++] = vert;
+static void
+replace_sprite(sprite_modal_ctx_t* ctx, const char* path) {
+	sprite_cache_t* cache = ctx->workspace->sprite_cache;
+	sprite_cache_entry_t* entry = sprite_cache_find(cache, path);
+	if (entry == NULL) {
+		size_t size = 0;
+		void* content = load_file_into_memory(path, &size);
+		if (content == NULL) {
+			show_text_popup(ctx->text_popup, "Could not read file");
+			return;
 		}
-	} else {
-		show_text_popup(ctx->text_popup, "Could not load file");
+
+		entry = sprite_cache_load(cache, path, content, size);
+		cf_free(content);
+	}
+
+	set_sprite(ctx, entry);
+	if (entry != NULL) {
+		sprite_cache_prefetch_siblings(cache, path);
 	}
 }
 
+// Moves to the next or previous sprite in the folder of the current one
 static void
-open_doc(CF_Coroutine coro) {
-	doc_modal_ctx_t ctx = *(doc_modal_ctx_t*)cf_coroutine_get_udata(coro);
-	if (!should_continue_after_saving_current_doc(coro, &ctx)) {
-		return;
+step_sprite(sprite_modal_ctx_t* ctx, int direction) {
+	if (ctx->tab->sprite_entry == NULL) { return; }
+
+	const char* path = ctx->tab->sprite_entry->path;
+	dyna char** siblings = list_sibling_sprites(path);
+	int index = find_string(siblings, path);
+	if (index >= 0 && alen(siblings) > 1) {
+		index = (index + direction + alen(siblings)) % alen(siblings);
+		replace_sprite(ctx, siblings[index]);
 	}
+	free_string_list(siblings);
+}
+
+#endif
+
+static void
+open_sprite(CF_Coroutine coro) {
+	sprite_modal_ctx_t ctx = *(sprite_modal_ctx_t*)cf_coroutine_get_udata(coro);
 
 #ifndef __EMSCRIPTEN__
 	nfdu8char_t* path = NULL;
 	nfdu8filteritem_t filters[] = {
 		{
-			.name = "JSON",
-			.spec = "json",
+			.name = "All supported sprites",
+			.spec = "ase,aseprite,png",
+		},
+		{
+			.name = "aseprite",
+			.spec = "ase,aseprite",
+		},
+		{
+			.name = "png",
+			.spec = "png",
 		}
 	};
 	nfdresult_t open_result = NFD_OpenDialogU8(
@@ -508,26 +5320,31 @@ open_doc(CF_Coroutine coro) {
 		NULL
 	);
 	if (open_result == NFD_OKAY) {
-		size_t size = 0;
-		void* content = load_file_into_memory(path, &size);
-		if (content != NULL) {
-			load_doc(&ctx, path, content, size);
-		} else {
-			show_text_popup(ctx.text_popup, "Could not load file");
-		}
-		cf_free(content);
+		replace_sprite(&ctx, path);
+		NFD_FreePathU8(path);
 	} else if (open_result == NFD_ERROR) {
 		show_text_popup(ctx.text_popup, NFD_GetError());
 	}
 #else
-	char* filename = NULL;
-	void* content = NULL;
-	size_t size;
-	if (web_open_file(".json", &filename, &content, &size)) {
-		load_doc(&ctx, filename, content, size);
+	// Picked files have no stable path so they are never looked up by name
+	sprite_cache_t* cache = ctx.workspace->sprite_cache;
+	web_file_t file = { 0 };
+	if (web_open_file(coro, ".ase,.aseprite,.png", true, &file)) {
+		if (file.width > 0) {
+			// PNG decoded by the browser, skip the compressed copy entirely
+			CF_Sprite new_sprite = cf_make_easy_sprite_from_pixels(file.content, file.width, file.height);
+			sprite_cache_entry_t* entry = NULL;
+			if (new_sprite.name) {
+				uint64_t* mask = fit_build_mask(file.content, file.width, file.height);
+				entry = sprite_cache_insert(cache, file.name, new_sprite, mask, file.width, file.height, 1);
+			}
+			set_sprite(&ctx, entry);
+		} else {
+			set_sprite(&ctx, sprite_cache_load(cache, file.name, file.content, file.size));
+		}
 	}
-	free(filename);
-	free(content);
+	free(file.name);
+	free(file.content);
 #endif
 }
 
@@ -538,82 +5355,252 @@ start_doc_modal(CF_Coroutine* modal_coro, CF_CoroutineFn fn, doc_modal_ctx_t* ct
 
 int
 main(int argc, const char* argv[]) {
+	int options = CF_APP_OPTIONS_WINDOW_POS_CENTERED_BIT | CF_APP_OPTIONS_RESIZABLE_BIT;
+	bool replaying = false;
+
 #ifndef __EMSCRIPTEN__
+	// --record <file> saves the input of the session
+	// --replay <file> runs a recorded session as fast as possible and prints
+	// frame time percentiles along with a hash of the resulting shapes
+	input_recorder_t recorder = { 0 };
+	input_replay_t replay = { 0 };
+	for (int i = 1; i + 1 < argc; ++i) {
+		if (strcmp(argv[i], "--record") == 0) {
+			if (!input_recorder_open(&recorder, argv[++i])) {
+				fprintf(stderr, "Could not create %s\n", argv[i]);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--replay") == 0) {
+			if (!input_replay_open(&replay, argv[++i])) {
+				fprintf(stderr, "Could not read recording %s\n", argv[i]);
+				return 1;
+			}
+			replaying = true;
+			options |= CF_APP_OPTIONS_HIDDEN_BIT;
+		}
+	}
+	bool recording = recorder.file != NULL;
+
 	NFD_Init();
+#else
+	(void)argc;
+	bool recording = false;
 #endif
 
-	int options = CF_APP_OPTIONS_WINDOW_POS_CENTERED_BIT | CF_APP_OPTIONS_RESIZABLE_BIT;
-	cf_make_app("cute shaper", 0, 0, 0, 640, 480, options, argv[0]);
+	// A replay starts at the recorded window size since culling and picking
+	// depend on it
+	int window_width = 640;
+	int window_height = 480;
+#ifndef __EMSCRIPTEN__
+	if (replaying && replay.num_frames > 0) {
+		window_width = replay.frames[0].width;
+		window_height = replay.frames[0].height;
+	}
+#endif
+	cf_make_app("cute shaper", 0, 0, 0, window_width, window_height, options, argv[0]);
 	cf_fs_mount(cf_fs_get_working_directory(), "/", true);
-	cf_app_set_vsync(true);
+	cf_app_set_vsync(!replaying);
 	cf_clear_color(0.5f, 0.5f, 0.5f, 0.f);
 	cf_app_init_imgui();
 
-	int sprite_index = 0;
-	(void)sprite_index;
-	CF_Sprite demo_sprite = cf_make_demo_sprite();
-	CF_Sprite sprite = demo_sprite;
+	// One worker per core besides the main thread, shared by sprite
+	// prefetching and the playground
+	CF_Threadpool* pool = NULL;
+#ifndef __EMSCRIPTEN__
+	int num_workers = cf_core_count() - 1;
+	pool = cf_make_threadpool(num_workers > 1 ? num_workers : 1);
+#endif
+
+	sprite_cache_t sprite_cache;
+	sprite_cache_init(&sprite_cache, pool);
+
+#ifndef __EMSCRIPTEN__
+	file_watcher_t watcher;
+	file_watcher_init(&watcher);
+#endif
 
-	cf_sprite_play(&sprite, "hold_down");
-	float draw_scale = 1.f;
-	CF_V2 draw_offset = { 0.f, 0.f };
+	workspace_t workspace = {
+		.demo_sprite = cf_make_demo_sprite(),
+		.sprite_cache = &sprite_cache,
+	};
+	cf_sprite_play(&workspace.demo_sprite, "hold_down");
+	workspace_add_doc(&workspace);
+	// Recovery decides when the last session's journal is replaced
+	workspace.journal_dirty = false;
 
 	CF_Coroutine modal_coro = { 0 };
 
-	shape_history_t* history = cf_alloc(sizeof(shape_history_t));
-	*history = (shape_history_t){ 0 };
-
-	document_t doc = { 0 };
+	workspace_doc_t* tab = workspace_active_doc(&workspace);
+	uint64_t last_tab_id = tab->id;
 	uint64_t last_shape_version = 0;
 	uint64_t last_doc_version = 0;
-	set_title(&doc, 0);
+	set_title(&tab->doc, 0);
+
+	// Sessions start from a blank document and must leave the journal of
+	// the last real session alone
+	journal_t journal;
+	journal_init(&journal, !recording && !replaying);
 
-	command_t command = COMMAND_NOOP;
+	command_t command = recording || replaying ? COMMAND_NOOP : COMMAND_RECOVER;
 	text_popup_t text_popup = { 0 };
+#ifndef __EMSCRIPTEN__
+	bool reported_journal_failure = false;
+#endif
+	handle_batch_t handles = { 0 };
+	polyline_lod_t outline_lod = { 0 };
+	int dragged_index = -1;
+	bool show_history = false;
+	fit_metrics_t fit = { 0 };
+	uint64_t fit_sprite_id = 0;
+	bool show_fit = false;
+	bool show_heatmap = true;
+	bool show_playground = false;
+	playground_t playground = {
+		.kind = PLAYGROUND_CIRCLES,
+		.num_bodies = 1000,
+		.body_size = 4.f,
+		.collide_bodies = true,
+		.running = true,
+		.draw_bodies = true,
+#ifndef __EMSCRIPTEN__
+		.pool = pool,
+#endif
+	};
+	import_t import = { 0 };
+	input_frame_t input = { 0 };
+	int canvas_width = 0;
+	int canvas_height = 0;
 
 	while (cf_app_is_running()) {
+		uint64_t frame_start = cf_get_ticks();
 		cf_app_update(NULL);
-		cf_sprite_update(&sprite);
+		sprite_cache_update(&sprite_cache);
+
+#ifndef __EMSCRIPTEN__
+		if (replaying) {
+			if (!input_replay_next(&replay, &input)) { break; }
+		} else {
+			input_capture(&input);
+			if (!input_recorder_write(&recorder, &input)) {
+				fprintf(stderr, "Could not write the input recording, recording stopped\n");
+				show_text_popup(&text_popup, "Could not write the input recording, recording stopped");
+			}
+		}
+#else
+		input_capture(&input);
+		// Browser navigation stays queued until no modal can swallow it
+		if (modal_coro.id == 0) {
+			input.nav = web_nav();
+		}
+#endif
+
+#ifndef __EMSCRIPTEN__
+		// Reload whatever changed on disk, held back while a modal could be
+		// editing the shape
+		file_watcher_sync(&watcher, &workspace);
+		if (modal_coro.id == 0) {
+			file_watcher_update(&watcher, CF_DELTA_TIME);
+			for (int i = 0; i < alen(watcher.changed); ++i) {
+				const char* path = watcher.changed[i];
+				sprite_cache_reload(&sprite_cache, path);
+				for (int j = 0; j < alen(workspace.docs); ++j) {
+					workspace_doc_t* other = workspace.docs[j];
+					if (other->doc.filename != NULL && strcmp(other->doc.filename, path) == 0) {
+						reload_doc(&workspace, other);
+					}
+				}
+			}
+		}
+#endif
+		workspace_refresh_sprites(&workspace);
+
+		tab = workspace_active_doc(&workspace);
+		document_t* doc = &tab->doc;
+		shape_history_t* history = tab->history;
+		CF_Sprite* sprite = &tab->sprite;
+		cf_sprite_update(sprite);
+
+		// The fit mask follows the sprite of the active tab
+		uint64_t sprite_id = tab->sprite_entry != NULL ? tab->sprite_entry->id : 0;
+		if (sprite_id != fit_sprite_id) {
+			if (tab->sprite_entry != NULL) {
+				sprite_cache_entry_t* entry = tab->sprite_entry;
+				fit_metrics_set_mask(&fit, entry->mask, entry->width, entry->height);
+			} else {
+				fit_metrics_clear(&fit);
+			}
+			fit_sprite_id = sprite_id;
+		}
 
-		// Handle resize
-		if (cf_app_was_resized()) {
-			int width = cf_app_get_width();
-			int height = cf_app_get_height();
-			cf_app_set_canvas_size(width, height);
-			cf_draw_projection(cf_ortho_2d(0, 0, (float)width, (float)height));
+		// Handle resize, replays follow the recorded window size
+		if (input.width != canvas_width || input.height != canvas_height) {
+			canvas_width = input.width;
+			canvas_height = input.height;
+#ifndef __EMSCRIPTEN__
+			if (replaying) {
+				cf_app_set_size(canvas_width, canvas_height);
+			}
+#endif
+			cf_app_set_canvas_size(canvas_width, canvas_height);
+			cf_draw_projection(cf_ortho_2d(0, 0, (float)canvas_width, (float)canvas_height));
 		}
 
 		shape_t* shape = current_shape(history);
 
+		// Dragging edits vertices in place without bumping the version
+		if (dragged_index >= 0) {
+			polyline_lod_invalidate(&outline_lod);
+			playground_invalidate(&playground);
+		}
+
+		if (show_playground) {
+			playground_update(&playground, shape, current_shape_version(history));
+		}
+
 		// Draw sprite and collision shape
+		float draw_scale = tab->draw_scale;
 		cf_draw_push();
-			cf_draw_translate_v2(draw_offset);
+			cf_draw_translate_v2(tab->draw_offset);
 			cf_draw_scale(draw_scale, draw_scale);
 			CF_M3x2 draw_transform = cf_draw_peek();
 
-			cf_draw_sprite(&sprite);
+			cf_draw_sprite(sprite);
+
+			if (show_fit) {
+				fit_metrics_update(&fit, shape);
+				if (show_heatmap) {
+					CF_M3x2 inv_transform = cf_invert(draw_transform);
+					CF_Aabb view = visible_world_bounds(&input, 0.f);
+					CF_V2 a = cf_mul(inv_transform, view.min);
+					CF_V2 b = cf_mul(inv_transform, view.max);
+					fit_metrics_draw_heatmap(&fit, cf_make_aabb(cf_min(a, b), cf_max(a, b)));
+				}
+			}
+
+			int num_outline_verts;
+			const CF_V2* outline = polyline_lod_select(
+				&outline_lod,
+				tab->id,
+				history,
+				draw_scale,
+				&num_outline_verts
+			);
+			cf_draw_polyline(outline, num_outline_verts, 0.2f, true);
 
-			cf_draw_polyline(shape->verts, shape->num_vertices, 0.2f, true);
+			if (show_playground) {
+				playground_draw(&playground);
+			}
 		cf_draw_pop();
 
-		CF_V2 mouse_world = cf_screen_to_world(cf_v2(cf_mouse_x(), cf_mouse_y()));
+		CF_V2 mouse_world = cf_screen_to_world(cf_v2(input.mouse_x, input.mouse_y));
 
 		// Draw vertices outside of transform for a consistent shape size
-		int hovered_vert = -1;
+		handle_batch_begin(&handles, visible_world_bounds(&input, VERT_SIZE));
 		for (int i = 0; i < shape->num_vertices; ++i) {
-			CF_V2 vert = cf_mul(draw_transform, shape->verts[i]);
-
-			bool vert_hovered = cf_len(cf_sub(vert, mouse_world)) <= VERT_SIZE;
-			CF_Color vert_color = vert_hovered ? cf_color_green() : cf_color_white();
-			vert_color.a = 0.5f;
-			if (vert_hovered) {
-				hovered_vert = i;
-			}
-
-			cf_draw_push_color(vert_color);
-			cf_draw_circle_fill2(vert, VERT_SIZE);
-			cf_draw_pop_color();
+			handle_batch_add(&handles, cf_mul(draw_transform, shape->verts[i]), i);
 		}
+		int hovered_vert = handle_batch_pick(&handles, mouse_world, VERT_SIZE);
+		handle_batch_draw(&handles, hovered_vert, VERT_SIZE);
 
 		// Find the closest edge
 		int insert_index = shape->num_vertices;
@@ -633,17 +5620,14 @@ main(int argc, const char* argv[]) {
 		}
 
 		// Highlight the closest edge
+		// Transformed on the CPU so it does not need its own transform push
 		if (hovered_vert == -1 && shape->num_vertices >= 3) {
-			cf_draw_push();
-			cf_draw_transform(draw_transform);
-			cf_draw_push_color(cf_color_green());
-
-			CF_V2 a = shape->verts[insert_index];
-			CF_V2 b = shape->verts[(insert_index + 1) % shape->num_vertices];
-			cf_draw_line(a, b, 1.f);
+			CF_V2 a = cf_mul(draw_transform, shape->verts[insert_index]);
+			CF_V2 b = cf_mul(draw_transform, shape->verts[(insert_index + 1) % shape->num_vertices]);
 
+			cf_draw_push_color(cf_color_green());
+			cf_draw_line(a, b, draw_scale);
 			cf_draw_pop_color();
-			cf_draw_pop();
 		}
 
 		// ImGui
@@ -667,84 +5651,34 @@ main(int argc, const char* argv[]) {
 					command = COMMAND_SAVE_AS;
 				}
 
+				if (ImGui_MenuItemEx("Close", "Ctrl+W", false, true)) {
+					command = COMMAND_CLOSE;
+				}
+
 				ImGui_EndMenu();
 			}
 
 			if (ImGui_BeginMenu("Sprite")) {
 				if (ImGui_MenuItem("Load")) {
-					#ifndef __EMSCRIPTEN__
-					nfdu8char_t* path = NULL;
-					nfdu8filteritem_t filters[] = {
-						{
-							.name = "All supported sprites",
-							.spec = "ase,aseprite,png",
-						},
-						{
-							.name = "aseprite",
-							.spec = "ase,aseprite",
-						},
-						{
-							.name = "png",
-							.spec = "png",
-						}
-					};
-					nfdresult_t open_result = NFD_OpenDialogU8(
-						&path,
-						filters, sizeof(filters) / sizeof(filters[0]),
-						NULL
-					);
-					if (open_result == NFD_OKAY) {
-						size_t size = 0;
-						void* content = load_file_into_memory(path, &size);
-						if (content != NULL) {
-							CF_Sprite new_sprite = load_sprite(path, content, size);
-							if (new_sprite.name) {
-								if (strcmp(sprite.name, "easy_sprite") == 0) {
-									cf_easy_sprite_unload(&sprite);
-								} else if (sprite.name != demo_sprite.name) {
-									cf_sprite_unload(sprite.name);
-								}
-								sprite = new_sprite;
-							} else {
-								show_text_popup(&text_popup, "Could not load sprite");
-							}
-
-							cf_free(content);
-						} else {
-							show_text_popup(&text_popup, "Could not read file");
-						}
+					command = COMMAND_LOAD_SPRITE;
+				}
 
-						NFD_FreePathU8(path);
-					} else if (open_result == NFD_ERROR) {
-						show_text_popup(&text_popup, NFD_GetError());
-					}
-					#else
-					char* filename = NULL;
-					void* content = NULL;
-					size_t size;
-					if (web_open_file(".ase,.aseprite,.png", &filename, &content, &size)) {
-						CF_Sprite new_sprite = load_sprite(filename, content, size);
-						if (new_sprite.name) {
-							if (strcmp(sprite.name, "easy_sprite") == 0) {
-								cf_easy_sprite_unload(&sprite);
-							} else if (sprite.name != demo_sprite.name) {
-								cf_sprite_unload(sprite.name);
-							}
-							sprite = new_sprite;
-						} else {
-							show_text_popup(&text_popup, "Could not load sprite");
-						}
-					}
-					free(filename);
-					free(content);
-					#endif
+#ifndef __EMSCRIPTEN__
+				bool has_folder = tab->sprite_entry != NULL;
+				if (ImGui_MenuItemEx("Next in folder", "Page Down", false, has_folder)) {
+					command = COMMAND_NEXT_SPRITE;
+				}
+
+				if (ImGui_MenuItemEx("Previous in folder", "Page Up", false, has_folder)) {
+					command = COMMAND_PREV_SPRITE;
 				}
+#endif
 
-				int num_anims = hsize(sprite.animations);
+				int num_anims = hsize(sprite->animations);
 				if (ImGui_BeginMenuEx("Animation", num_anims > 0)) {
-					for (int i = 0; i < hsize(sprite.animations); ++i) {
-						if (ImGui_MenuItem(sprite.animations[i]->name)) {
-							cf_sprite_play(&sprite, sprite.animations[i]->name);
+					for (int i = 0; i < hsize(sprite->animations); ++i) {
+						if (ImGui_MenuItem(sprite->animations[i]->name)) {
+							workspace_doc_play(tab, sprite->animations[i]->name);
 						}
 					}
 					ImGui_EndMenu();
@@ -752,6 +5686,13 @@ main(int argc, const char* argv[]) {
 				ImGui_EndMenu();
 			}
 
+			if (ImGui_BeginMenu("View")) {
+				ImGui_MenuItemBoolPtr("History", NULL, &show_history, true);
+				ImGui_MenuItemBoolPtr("Fit quality", NULL, &show_fit, true);
+				ImGui_MenuItemBoolPtr("Playground", NULL, &show_playground, true);
+				ImGui_EndMenu();
+			}
+
 			if (ImGui_BeginMenu("Help")) {
 				if (ImGui_MenuItem("How to use")) {
 					ImGui_OpenPopupID(help_popup, ImGuiPopupFlags_AnyPopup);
@@ -761,6 +5702,28 @@ main(int argc, const char* argv[]) {
 			ImGui_EndMainMenuBar();
 		}
 
+		// Tabs can't change under a running modal
+		if (modal_coro.id != 0) {
+			workspace.select_active = true;
+		}
+		workspace_doc_t* close_target = workspace_tab_bar(&workspace, ImGui_GetFrameHeight());
+
+		shape_node_t* jump_target = NULL;
+		if (show_history) {
+			jump_target = history_browser(history, &show_history);
+		}
+
+		if (show_fit) {
+			int num_frames = tab->sprite_entry != NULL ? tab->sprite_entry->num_frames : 1;
+			fit_metrics_window(&fit, num_frames, &show_fit, &show_heatmap);
+		}
+
+		if (show_playground) {
+			playground_window(&playground, &show_playground);
+		}
+
+		import_window(&import, &workspace, modal_coro.id == 0);
+
 		if (ImGui_BeginPopup("Help", ImGuiWindowFlags_AlwaysAutoResize)) {
 			ImGui_Text(
 				"Left click: Add vertex\n"
@@ -783,165 +5746,280 @@ main(int argc, const char* argv[]) {
 		}
 
 		// Current modal action
+		bool modal_done = false;
 		if (modal_coro.id != 0) {
 			cf_coroutine_resume(modal_coro);
 			if (cf_coroutine_state(modal_coro) == CF_COROUTINE_STATE_DEAD) {
 				cf_destroy_coroutine(modal_coro);
 				modal_coro.id = 0;
+				modal_done = true;
+
+				if (dragged_index >= 0) {
+					journal_set(&journal, dragged_index, current_shape(tab->history)->verts[dragged_index]);
+					dragged_index = -1;
+				}
 			}
 		}
 
+		// A finished modal may have closed tabs, so everything picked above
+		// against the old tab is dropped for this frame
+		if (modal_done) {
+			tab = workspace_active_doc(&workspace);
+			doc = &tab->doc;
+			history = tab->history;
+			jump_target = NULL;
+			close_target = NULL;
+		}
+		bool accept_input = modal_coro.id == 0 && !modal_done;
+
 		// Mouse handling
-		if (modal_coro.id == 0 && !ImGui_GetIO()->WantCaptureMouse) {
+		if (accept_input && !(input.ui_capture & INPUT_CAPTURE_MOUSE)) {
 #ifndef __EMSCRIPTEN__
-			bool undo = cf_mouse_just_pressed(CF_MOUSE_BUTTON_X1);
-			bool redo = cf_mouse_just_pressed(CF_MOUSE_BUTTON_X2);
+			bool undo = input_button_pressed(&input, CF_MOUSE_BUTTON_X1);
+			bool redo = input_button_pressed(&input, CF_MOUSE_BUTTON_X2);
 #else
-			int nav = web_nav();
-			bool undo = nav == NAV_BACK;
-			bool redo = nav == NAV_FORWARD;
+			bool undo = input.nav == NAV_BACK;
+			bool redo = input.nav == NAV_FORWARD;
 #endif
 
-			if (cf_mouse_just_pressed(CF_MOUSE_BUTTON_MIDDLE)) {  // Pan
+			if (input_button_pressed(&input, CF_MOUSE_BUTTON_MIDDLE)) {  // Pan
 				start_mouse_drag(&modal_coro, &(mouse_drag_info_t){
-					.point = &draw_offset,
+					.point = &tab->draw_offset,
 					.button = CF_MOUSE_BUTTON_MIDDLE,
 					.scale = 1.f,
+					.input = &input,
 				});
-			} else if (cf_mouse_just_pressed(CF_MOUSE_BUTTON_LEFT)) {  // Drag or add
+			} else if (input_button_pressed(&input, CF_MOUSE_BUTTON_LEFT)) {  // Drag or add
 				shape = commit_shape(history);
+				journal_commit(&journal);
 
-				CF_V2* dragged_vert = NULL;
 				if (hovered_vert >= 0) {  // Drag
-					dragged_vert = &shape->verts[hovered_vert];
+					dragged_index = hovered_vert;
 				} else if (shape->num_vertices < MAX_NUM_VERTICES) {  // Add
 					CF_V2 new_vert = cf_mul(cf_invert(draw_transform), mouse_world);
 
-					if (shape->num_vertices < 3) {
-						// Insert at the end
-						shape->verts[shape->num_vertices++] = new_vert;
-						dragged_vert = &shape->verts[shape->num_vertices - 1];
-					} else {
-						// Insert between the closest edge
-						memmove(
-							&shape->verts[insert_index + 2],
-							&shape->verts[insert_index + 1],
-							(shape->num_vertices - insert_index - 1) * sizeof(shape->verts[0])
-						);
-						shape->verts[insert_index + 1] = new_vert;
-						++shape->num_vertices;
-						dragged_vert = &shape->verts[insert_index + 1];
-					}
+					// Insert at the end or between the closest edge
+					int new_index = shape->num_vertices < 3 ? shape->num_vertices : insert_index + 1;
+					shape_insert_vertex(shape, new_index, new_vert);
+					journal_insert(&journal, new_index, new_vert);
+					dragged_index = new_index;
 				}
 
-				if (dragged_vert != NULL) {
+				if (dragged_index >= 0) {
 					start_mouse_drag(&modal_coro, &(mouse_drag_info_t){
-						.point = dragged_vert,
+						.point = &shape->verts[dragged_index],
 						.button = CF_MOUSE_BUTTON_LEFT,
 						.scale = draw_scale,
+						.input = &input,
 					});
 				}
-			} else if (cf_mouse_just_pressed(CF_MOUSE_BUTTON_RIGHT) && hovered_vert >= 0) {  // Delete
+			} else if (input_button_pressed(&input, CF_MOUSE_BUTTON_RIGHT) && hovered_vert >= 0) {  // Delete
 				shape = commit_shape(history);
-				memmove(
-					&shape->verts[hovered_vert],
-					&shape->verts[hovered_vert + 1],
-					(shape->num_vertices - hovered_vert) * sizeof(shape->verts[0])
-				);
-				--shape->num_vertices;
+				journal_commit(&journal);
+				shape_remove_vertex(shape, hovered_vert);
+				journal_remove(&journal, hovered_vert);
 			} else if (undo) {
-				int prev_index = history->current_index - 1;
-				if (prev_index < 0) { prev_index += MAX_HISTORY_ENTRIES; }
-				shape_history_entry_t* prev_entry = &history->entries[prev_index];
-				if (prev_entry->version < history->entries[history->current_index].version) {
-					history->current_index = prev_index;
-					shape = &prev_entry->shape;
+				if (history_undo(history)) {
+					shape = current_shape(history);
+					journal_undo(&journal, doc, shape, doc->saved_version == current_shape_version(history));
 				}
 			} else if (redo) {
-				int next_index = (history->current_index + 1) % MAX_HISTORY_ENTRIES;
-				shape_history_entry_t* next_entry = &history->entries[next_index];
-				if (next_entry->version > history->entries[history->current_index].version) {
-					history->current_index = next_index;
-					shape = &next_entry->shape;
+				if (history_redo(history)) {
+					shape = current_shape(history);
+					journal_redo(&journal, doc, shape, doc->saved_version == current_shape_version(history));
 				}
-			} else if (cf_mouse_wheel_motion() != 0.f) {  // Zoom
-				draw_scale += cf_mouse_wheel_motion() * 0.25f;
+			} else if (input.wheel != 0.f) {  // Zoom
+				tab->draw_scale += input.wheel * 0.25f;
 			}
 		}
 
+		// History browser
+		if (accept_input && jump_target != NULL && jump_target != history->current) {
+			history_jump(history, jump_target);
+			shape = current_shape(history);
+			journal_jump(&journal, doc, shape, doc->saved_version == current_shape_version(history));
+		}
+
 		// Keyboard shortcut
-		if (modal_coro.id == 0 && !ImGui_GetIO()->WantCaptureKeyboard) {
-			if (cf_key_down(CF_KEY_LCTRL) || cf_key_down(CF_KEY_LCTRL)) {
-				if (cf_key_just_pressed(CF_KEY_N)) {
+		if (accept_input && !(input.ui_capture & INPUT_CAPTURE_KEYBOARD)) {
+			if (input_key_down(&input, INPUT_KEY_CTRL)) {
+				if (input_key_pressed(&input, INPUT_KEY_N)) {
 					command = COMMAND_NEW;
-				} else if (cf_key_just_pressed(CF_KEY_O)) {
+				} else if (input_key_pressed(&input, INPUT_KEY_O)) {
 					command = COMMAND_OPEN;
-				} else if (cf_key_just_pressed(CF_KEY_S)) {
-					if (cf_key_down(CF_KEY_LSHIFT) || cf_key_down(CF_KEY_RSHIFT)) {
+				} else if (input_key_pressed(&input, INPUT_KEY_W)) {
+					command = COMMAND_CLOSE;
+				} else if (input_key_pressed(&input, INPUT_KEY_S)) {
+					if (input_key_down(&input, INPUT_KEY_SHIFT)) {
 						command = COMMAND_SAVE_AS;
 					} else {
 						command = COMMAND_SAVE;
 					}
 				}
+			} else if (input_key_pressed(&input, INPUT_KEY_PAGE_DOWN)) {
+				command = COMMAND_NEXT_SPRITE;
+			} else if (input_key_pressed(&input, INPUT_KEY_PAGE_UP)) {
+				command = COMMAND_PREV_SPRITE;
 			}
 		}
 
+		// Nobody is there to answer a file dialog or a prompt during a replay
+		if (replaying && command != COMMAND_NEW) {
+			command = COMMAND_NOOP;
+			close_target = NULL;
+		}
+
 		// Command execution
 		doc_modal_ctx_t modal_ctx = {
 			.text_popup = &text_popup,
-			.doc = &doc,
+			.workspace = &workspace,
+			.tab = tab,
+			.doc = doc,
 			.history = history,
+			.journal = &journal,
+			.import = &import,
+		};
+		sprite_modal_ctx_t sprite_ctx = {
+			.text_popup = &text_popup,
+			.workspace = &workspace,
+			.tab = tab,
 		};
 
+		if (accept_input && close_target != NULL) {
+			modal_ctx.tab = close_target;
+			modal_ctx.doc = &close_target->doc;
+			modal_ctx.history = close_target->history;
+			command = COMMAND_CLOSE;
+		}
+
 		switch (command) {
 			case COMMAND_NEW: {
-				start_doc_modal(&modal_coro, new_doc, &modal_ctx);
+				workspace_add_doc(&workspace);
 			} break;
 			case COMMAND_OPEN: {
 				start_doc_modal(&modal_coro, open_doc, &modal_ctx);
 			} break;
 			case COMMAND_SAVE: {
-				save_doc(&modal_ctx);
+				start_doc_modal(&modal_coro, save_doc_modal, &modal_ctx);
 			} break;
 			case COMMAND_SAVE_AS: {
-				save_doc_as(&modal_ctx);
+				start_doc_modal(&modal_coro, save_doc_as_modal, &modal_ctx);
+			} break;
+			case COMMAND_CLOSE: {
+				start_doc_modal(&modal_coro, close_doc, &modal_ctx);
+			} break;
+			case COMMAND_RECOVER: {
+				start_doc_modal(&modal_coro, recover_doc, &modal_ctx);
+			} break;
+			case COMMAND_LOAD_SPRITE: {
+				start_modal(&modal_coro, open_sprite, &sprite_ctx);
+			} break;
+			case COMMAND_NEXT_SPRITE: {
+#ifndef __EMSCRIPTEN__
+				step_sprite(&sprite_ctx, 1);
+#endif
+			} break;
+			case COMMAND_PREV_SPRITE: {
+#ifndef __EMSCRIPTEN__
+				step_sprite(&sprite_ctx, -1);
+#endif
 			} break;
 			case COMMAND_NOOP: break;
 		}
 
+		// Commands may have switched or closed tabs
+		tab = workspace_active_doc(&workspace);
+		doc = &tab->doc;
+		history = tab->history;
+
+		// Ids rather than pointers since a closed tab's memory can come
+		// back for a new one
+		bool tab_changed = tab->id != last_tab_id;
+		if (tab_changed || workspace.journal_dirty) {
+			journal_begin(&journal, &workspace);
+			last_tab_id = tab->id;
+		}
+
 		// Update title
 		uint64_t shape_version = current_shape_version(history);
 		if (
+			tab_changed
+			||
 			last_shape_version != shape_version
 			||
-			last_doc_version != doc.saved_version
+			last_doc_version != doc->saved_version
 			||
 			command != COMMAND_NOOP
 		) {
-			set_title(&doc, shape_version);
+			set_title(doc, shape_version);
 
 			last_shape_version = shape_version;
-			last_doc_version = doc.saved_version;
+			last_doc_version = doc->saved_version;
 		}
 
 		command = COMMAND_NOOP;
 
+		if (journal_update(&journal, CF_DELTA_TIME)) {
+			workspace.journal_dirty = true;
+		}
+#ifndef __EMSCRIPTEN__
+		// Only said once per outage, retries keep going quietly
+		if (journal.failed && !reported_journal_failure && modal_coro.id == 0) {
+			show_text_popup(
+				&text_popup,
+				"Could not write the recovery journal.\n\n"
+				"Unsaved changes will not be recovered after a crash until this is resolved."
+			);
+			reported_journal_failure = true;
+		}
+		if (!journal.failed) { reported_journal_failure = false; }
+#endif
+
 		cf_app_draw_onto_screen(true);
+
+#ifndef __EMSCRIPTEN__
+		if (replaying) {
+			double frame_time = (double)(cf_get_ticks() - frame_start) * 1000.0 / (double)cf_get_tick_frequency();
+			apush(replay.frame_times, frame_time);
+		}
+#else
+		(void)frame_start;
+#endif
+	}
+
+#ifndef __EMSCRIPTEN__
+	if (replaying) {
+		input_replay_report(&replay, workspace_hash_shapes(&workspace));
 	}
+	input_replay_cleanup(&replay);
+	if (!input_recorder_close(&recorder)) {
+		fprintf(stderr, "Could not finish writing the input recording\n");
+	}
+#endif
 
 	if (modal_coro.id != 0) {
 		cf_destroy_coroutine(modal_coro);
 	}
 
+	journal_cleanup(&journal);
+	handle_batch_cleanup(&handles);
+	polyline_lod_cleanup(&outline_lod);
+	fit_metrics_clear(&fit);
+	playground_cleanup(&playground);
+	import_cleanup(&import);
+	workspace_cleanup(&workspace);
+	sprite_cache_cleanup(&sprite_cache);
+#ifndef __EMSCRIPTEN__
+	cf_destroy_threadpool(pool);
+	file_watcher_cleanup(&watcher);
+#endif
 	cf_destroy_app();
 
 #ifndef __EMSCRIPTEN__
 	NFD_Quit();
 #endif
 
-	cf_free(history);
 	cf_free(title_buf);
-	cf_free(doc.filename);
 
 	return 0;
 }
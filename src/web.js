@@ -1,5 +1,6 @@
 addToLibrary({
 	$web_init__postset: 'web_init();',
+	$web_init__deps: ['$addRunDependency', '$removeRunDependency', 'malloc', 'free'],
 	$web_init: () => {
 		let numBacks = 0;
 		let numForwards = 0;
@@ -20,68 +21,304 @@ addToLibrary({
 			}
 		}, true);
 
-		_web_open_file = (filter, name_ptr, content_ptr, size_ptr) => {
-			const input = document.createElement('input');
-			input.type = 'file';
-
-			return Asyncify.handleAsync(async () => {
-				input.accept = UTF8ToString(filter);
-				input.click();
+		// File picking is split into a request and a poll so the wasm side
+		// never has to block on the browser.
+		//
+		// Content goes into the wasm heap exactly once: PNGs are decoded by the
+		// browser and only their pixels are copied, everything else is streamed
+		// chunk by chunk into one allocation of the final size. The heap still
+		// grows for that allocation, but only once and never for a copy.
+		let pendingFile = null;
 
-				const files = await new Promise((resolve) => {
-					input.addEventListener("change", (event) => {
-						resolve(Array.from(input.files));
-					}, {once: true});
+		const decodePng = async (file) => {
+			if (typeof createImageBitmap === 'undefined' || typeof OffscreenCanvas === 'undefined') {
+				return null;
+			}
 
-					input.addEventListener("cancel", (event) => {
-						resolve([]);
-					}, {once: true});
+			try {
+				const bitmap = await createImageBitmap(file, {
+					premultiplyAlpha: 'none',
+					colorSpaceConversion: 'none',
 				});
+				const canvas = new OffscreenCanvas(bitmap.width, bitmap.height);
+				const ctx = canvas.getContext('2d');
+				ctx.drawImage(bitmap, 0, 0);
+				bitmap.close();
+				return ctx.getImageData(0, 0, canvas.width, canvas.height);
+			} catch (e) {
+				return null;
+			}
+		}
+
+		const streamIntoHeap = async (file) => {
+			const content = _malloc(Math.max(file.size, 1));
+			if (content === 0) { return 0; }
 
-				if (files.length === 1) {
-					const file = files[0];
-
-					const nameLength = lengthBytesUTF8(file.name);
-					const name = _malloc(nameLength + 1);
-					stringToUTF8(file.name, name, nameLength + 1);
-
-					const buffer = new Uint8Array(await file.arrayBuffer());
-					const content = _malloc(buffer.byteLength);
-					HEAPU8.set(buffer, content);
-
-					setValue(name_ptr, name, 'i32');
-					setValue(content_ptr, content, 'i32');
-					setValue(size_ptr, buffer.byteLength, 'i32');
-					return 1;
-				} else {
-					setValue(name_ptr, 0, 'i32');
-					setValue(content_ptr, 0, 'i32');
-					setValue(size_ptr, 0, 'i32');
+			let offset = 0;
+			const reader = file.stream().getReader();
+			while (true) {
+				const { done, value } = await reader.read();
+				if (done) { break; }
+				if (offset + value.byteLength > file.size) {
+					_free(content);
 					return 0;
 				}
-			});
+				// HEAPU8 is looked up every time since the heap may have grown
+				HEAPU8.set(value, content + offset);
+				offset += value.byteLength;
+			}
+
+			// A stream that ended early would hand uninitialized memory to C
+			if (offset !== file.size) {
+				_free(content);
+				return 0;
+			}
+
+			return content;
 		}
 
-		_save_into_file = (path, data, size) => {
+		_web_request_file = (filter, decodeImages) => {
+			const request = {
+				done: false,
+				name: null,
+				content: 0,
+				size: 0,
+				width: 0,
+				height: 0,
+			};
+			pendingFile = request;
+
+			const input = document.createElement('input');
+			input.type = 'file';
+			input.accept = UTF8ToString(filter);
+
+			input.addEventListener("change", async (event) => {
+				// A file that can't be read, or was revoked, counts as cancelled
+				// so the modal waiting on it can finish
+				try {
+					const files = Array.from(input.files);
+					if (files.length === 1) {
+						const file = files[0];
+						request.name = file.name;
+
+						const image = decodeImages && file.name.toLowerCase().endsWith('.png')
+							? await decodePng(file)
+							: null;
+						if (image !== null) {
+							request.size = image.data.byteLength;
+							request.content = _malloc(request.size);
+							if (request.content !== 0) {
+								HEAPU8.set(image.data, request.content);
+								request.width = image.width;
+								request.height = image.height;
+							}
+						} else {
+							request.size = file.size;
+							request.content = await streamIntoHeap(file);
+						}
+					}
+				} catch (e) {
+					if (request.content !== 0) {
+						_free(request.content);
+						request.content = 0;
+					}
+				} finally {
+					request.done = true;
+				}
+			}, {once: true});
+
+			input.addEventListener("cancel", (event) => {
+				request.done = true;
+			}, {once: true});
+
+			input.click();
+		}
+
+		_web_poll_file = (file_ptr) => {
+			// Layout of web_file_t on wasm32
+			const namePtr = file_ptr;
+			const contentPtr = file_ptr + 4;
+			const sizePtr = file_ptr + 8;
+			const widthPtr = file_ptr + 12;
+			const heightPtr = file_ptr + 16;
+
+			if (pendingFile === null) {
+				return 2;  // WEB_FILE_CANCELLED
+			} else if (!pendingFile.done) {
+				return 0;  // WEB_FILE_PENDING
+			}
+
+			const request = pendingFile;
+			pendingFile = null;
+			if (request.content === 0) {
+				return 2;  // WEB_FILE_CANCELLED
+			}
+
+			const nameLength = lengthBytesUTF8(request.name);
+			const name = _malloc(nameLength + 1);
+			stringToUTF8(request.name, name, nameLength + 1);
+
+			setValue(namePtr, name, 'i32');
+			setValue(contentPtr, request.content, 'i32');
+			setValue(sizePtr, request.size, 'i32');
+			setValue(widthPtr, request.width, 'i32');
+			setValue(heightPtr, request.height, 'i32');
+			return 1;  // WEB_FILE_READY
+		}
+
+		// Saving is a request and a poll as well, so a document only counts as
+		// saved once the browser has actually written it. Files picked through
+		// the File System Access API are kept here under an id that the
+		// document holds on to, later saves of the same document go back to
+		// the same file without asking.
+		const saveHandles = new Map();
+		let nextSaveHandle = 1;
+		let pendingSave = null;
+
+		const downloadBlob = (name, blob) => {
 			const a = document.createElement("a");
 			a.target = "_blank";
-			if (path === 0) {
-				a.download = "shape.json";
-			} else {
-				a.download = UTF8ToString(path);
+			a.download = name;
+
+			const url = URL.createObjectURL(blob);
+			a.href = url;
+
+			a.click();
+			URL.revokeObjectURL(url);
+		}
+
+		const streamBlob = async (request, handle, name, blob) => {
+			try {
+				let fileHandle = saveHandles.get(handle);
+				if (fileHandle === undefined) {
+					fileHandle = await window.showSaveFilePicker({ suggestedName: name });
+					handle = nextSaveHandle++;
+					saveHandles.set(handle, fileHandle);
+				}
+
+				const writable = await fileHandle.createWritable();
+				await blob.stream().pipeTo(writable);
+				request.handle = handle;
+				request.name = fileHandle.name;
+				request.status = 1;  // WEB_SAVE_DONE
+			} catch (e) {
+				// A handle that stopped working is forgotten, the next save asks
+				saveHandles.delete(handle);
+				request.status = e.name === 'AbortError'
+					? 2  // WEB_SAVE_CANCELLED
+					: 3;  // WEB_SAVE_ERROR
+			} finally {
+				request.done = true;
 			}
+		}
+
+		_web_request_save = (handle, path, data, size) => {
+			const name = path === 0 ? "shape.json" : UTF8ToString(path);
 
+			// The only copy out of the heap, the caller frees data on return
 			const blob = new Blob(
 				[HEAPU8.subarray(data, data + size)],
 				{type: "application/json"}
 			);
-			const url = URL.createObjectURL(blob);
-			a.href = url;
 
-			a.click();
-			URL.revokeObjectURL(url);
+			const request = {
+				done: false,
+				status: 0,
+				handle: 0,
+				name: null,
+			};
+			pendingSave = request;
+
+			if (typeof window.showSaveFilePicker === 'function') {
+				streamBlob(request, handle, name, blob);
+			} else {
+				// Nothing reports whether a download was kept
+				downloadBlob(name, blob);
+				request.status = 1;  // WEB_SAVE_DONE
+				request.done = true;
+			}
+		}
+
+		_web_poll_save = (handle_ptr, name_ptr) => {
+			if (pendingSave === null) {
+				return 3;  // WEB_SAVE_ERROR
+			} else if (!pendingSave.done) {
+				return 0;  // WEB_SAVE_PENDING
+			}
+
+			const request = pendingSave;
+			pendingSave = null;
+
+			let name = 0;
+			if (request.name !== null) {
+				const nameLength = lengthBytesUTF8(request.name);
+				name = _malloc(nameLength + 1);
+				stringToUTF8(request.name, name, nameLength + 1);
+			}
+			setValue(handle_ptr, request.handle, 'i32');
+			setValue(name_ptr, name, 'i32');
+			return request.status;
+		}
 
-			return true;
+		// The journal is read before main() runs so recovery does not need to
+		// block on IndexedDB
+		let journalDb = null;
+		let journalBytes = null;
+		addRunDependency('web_journal');
+		const journalRequest = indexedDB.open('cute-shaper', 1);
+		journalRequest.onupgradeneeded = () => {
+			journalRequest.result.createObjectStore('journal', { autoIncrement: true });
+		};
+		journalRequest.onsuccess = () => {
+			journalDb = journalRequest.result;
+			const getAll = journalDb
+				.transaction('journal', 'readonly')
+				.objectStore('journal')
+				.getAll();
+			getAll.onsuccess = () => {
+				const chunks = getAll.result;
+				let size = 0;
+				for (const chunk of chunks) { size += chunk.byteLength; }
+				journalBytes = new Uint8Array(size);
+				let offset = 0;
+				for (const chunk of chunks) {
+					journalBytes.set(chunk, offset);
+					offset += chunk.byteLength;
+				}
+				removeRunDependency('web_journal');
+			};
+			getAll.onerror = () => removeRunDependency('web_journal');
+		};
+		journalRequest.onerror = () => removeRunDependency('web_journal');
+
+		_web_journal_load = (content_ptr, size_ptr) => {
+			if (journalBytes === null || journalBytes.byteLength === 0) {
+				setValue(content_ptr, 0, 'i32');
+				setValue(size_ptr, 0, 'i32');
+				return 0;
+			}
+
+			const content = _malloc(journalBytes.byteLength);
+			HEAPU8.set(journalBytes, content);
+			setValue(content_ptr, content, 'i32');
+			setValue(size_ptr, journalBytes.byteLength, 'i32');
+			journalBytes = null;
+			return 1;
+		}
+
+		// Each flushed batch is one record. Transactions on the same store
+		// complete in order so the records concatenate back into the journal.
+		_web_journal_append = (data, size, truncate) => {
+			if (journalDb === null) { return; }
+
+			const chunk = HEAPU8.slice(data, data + size);
+			const store = journalDb
+				.transaction('journal', 'readwrite')
+				.objectStore('journal');
+			if (truncate) {
+				store.clear();
+			}
+			store.add(chunk);
 		}
 
 		_web_nav = () => {
@@ -96,10 +333,18 @@ addToLibrary({
 			return result;
 		}
 	},
-	web_open_file: () => {},
-	web_open_file__deps: ['$web_init'],
-	save_into_file: () => {},
-	save_into_file__deps: ['$web_init'],
+	web_request_file: () => {},
+	web_request_file__deps: ['$web_init'],
+	web_poll_file: () => {},
+	web_poll_file__deps: ['$web_init'],
+	web_request_save: () => {},
+	web_request_save__deps: ['$web_init'],
+	web_poll_save: () => {},
+	web_poll_save__deps: ['$web_init'],
+	web_journal_load: () => {},
+	web_journal_load__deps: ['$web_init'],
+	web_journal_append: () => {},
+	web_journal_append__deps: ['$web_init'],
 	web_nav: () => {},
 	web_nav__deps: ['$web_init'],
 });